@@ -1,5 +1,6 @@
 #include <benchmark/benchmark.h>
 #include "utilcpp.h"
+#include <unordered_map>
 
 extern "C" {
 #include <stdio.h>
@@ -122,6 +123,118 @@ APPEND_buffet (benchmark::State& state)
     }
 }
 
+//=============================================================================
+// equal contents at distinct addresses : full compare
+static void
+EQ_cpp (benchmark::State& state) 
+{
+    GETLEN
+
+    // same memory as EQ_buffet
+    Buffet bufa = bft_memcopy(alpha, len);
+    Buffet bufb = bft_memcopy(alpha+64, len);
+    auto a = string_view(bft_data(&bufa), len);
+    auto b = string_view(bft_data(&bufb), len);
+
+    for (auto _ : state) {
+        bool eq = (a == b);
+        benchmark::DoNotOptimize(eq);
+    }
+
+    bft_free(&bufa);
+    bft_free(&bufb);
+}
+
+static void
+EQ_buffet (benchmark::State& state) 
+{
+    GETLEN
+
+    Buffet a = bft_memcopy(alpha, len);
+    Buffet b = bft_memcopy(alpha+64, len);
+
+    for (auto _ : state) {
+        bool eq = bft_eq(&a, &b);
+        benchmark::DoNotOptimize(eq);
+    }
+
+    bft_free(&a);
+    bft_free(&b);
+}
+
+//=============================================================================
+// keys "0".."N-1" suffixed to mix SSO and heap sizes
+static vector<string>
+mapkeys (size_t cnt)
+{
+    vector<string> keys;
+    for (size_t i = 0; i < cnt; ++i) 
+        keys.push_back(to_string(i) + (i%2 ? "" : "-key-past-sso-size"));
+    return keys;
+}
+
+static void
+MAPGET_cpp (benchmark::State& state) 
+{
+    const auto keys = mapkeys(state.range(0));
+    unordered_map<string, int> map;
+    for (size_t i = 0; i < keys.size(); ++i) map[keys[i]] = i;
+
+    for (auto _ : state) {
+        long sum = 0;
+        for (auto& k : keys) sum += map.find(k)->second;
+        benchmark::DoNotOptimize(sum);
+    }
+}
+
+static void
+MAPGET_buffet (benchmark::State& state) 
+{
+    const auto keys = mapkeys(state.range(0));
+    BuffetMap map = BUFFET_MAP_ZERO;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        Buffet key = bft_memview(keys[i].data(), keys[i].size());
+        bft_map_put(&map, &key, (void*)(intptr_t)i);
+    }
+
+    for (auto _ : state) {
+        long sum = 0;
+        for (auto& k : keys) 
+            sum += (intptr_t)*bft_map_getmem(&map, k.data(), k.size());
+        benchmark::DoNotOptimize(sum);
+    }
+
+    bft_map_free(&map);
+}
+
+static void
+MAPPUT_cpp (benchmark::State& state) 
+{
+    const auto keys = mapkeys(state.range(0));
+
+    for (auto _ : state) {
+        unordered_map<string, int> map;
+        for (size_t i = 0; i < keys.size(); ++i) map[keys[i]] = i;
+        benchmark::DoNotOptimize(map);
+    }
+}
+
+static void
+MAPPUT_buffet (benchmark::State& state) 
+{
+    const auto keys = mapkeys(state.range(0));
+
+    for (auto _ : state) {
+        BuffetMap map = BUFFET_MAP_ZERO;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            Buffet key = bft_memview(keys[i].data(), keys[i].size());
+            bft_map_put(&map, &key, (void*)(intptr_t)i);
+        }
+        benchmark::DoNotOptimize(map);
+        bft_map_free(&map);
+    }
+}
+
 //=============================================================================
 static void 
 SPLITJOIN_c (benchmark::State& state) 
@@ -195,7 +308,16 @@ BENCHMARK(two)->Args({24,4});\
 BENCHMARK(one)->Args({24,32});\
 BENCHMARK(two)->Args({24,32});\
 
+#define MAP(one, two) \
+BENCHMARK(one)->Arg(1000); \
+BENCHMARK(two)->Arg(1000); \
+BENCHMARK(one)->Arg(100000); \
+BENCHMARK(two)->Arg(100000); \
+
 MEMVIEW (MEMVIEW_cpp, MEMVIEW_buffet);
+MEMCOPY (EQ_cpp, EQ_buffet);
+MAP (MAPGET_cpp, MAPGET_buffet);
+MAP (MAPPUT_cpp, MAPPUT_buffet);
 MEMCOPY (MEMCOPY_c, MEMCOPY_buffet);
 APPEND (APPEND_cpp, APPEND_buffet);
 BENCHMARK(SPLITJOIN_c);
@@ -3,11 +3,42 @@ Buffet - All-inclusive Buffer for C
 Copyright (C) 2022 - Francois Alcover <francois|at|alcover|dot|fr>
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <float.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_URING 1
+#endif
+#endif
+#endif
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
 #include "buffet.h"
 #include "log.h"
+#include "pow10.h"
 
 typedef enum {SSO=0, OWN, SSV, VUE} Tag;
 
@@ -16,11 +47,22 @@ typedef struct {
     size_t   cap;       // capacity
     size_t   len;       // current length (for append in place)
     uint32_t refcnt;    // number of co-owners
+    uint32_t flags;     // STORE_*
+    uint64_t hash;      // cached bft_hash() of the whole data
     volatile
     uint32_t canary;    // prevents accessing stale store
+    _Alignas(size_t)
     char     data[1];
 } Store;
 
+// store flags
+#define STORE_MAPPED 1  // read-only file mapping
+#define STORE_HASHED 2  // `hash` is set
+#define STORE_UTF8   4  // data is valid UTF-8
+
+// cached properties of the whole data, dropped on write
+#define STORE_CACHES (STORE_HASHED|STORE_UTF8)
+
 #define CANARY 0xbeacface   
 #define OVERALLOC 2  // growth factor
 #define SSO_MAXREF 255 // maximum number of views on an SSO
@@ -47,22 +89,75 @@ getstore (const Buffet *buf) {
     return (Store*)(buf->ptr.data - (DATAOFF + buf->ptr.off));
 }
 
+// Drop cached properties of store data about to change.
+static inline void
+touch_store (Store *store) {
+    store->flags &= ~STORE_CACHES;
+}
+
+// Caches are filled through const Buffets, maybe by concurrent readers
+// of a shared store : a flag is set atomically, after what it vouches for.
+static inline bool
+store_cached (const Store *store, uint32_t flag) {
+    return __atomic_load_n(&store->flags, __ATOMIC_ACQUIRE) & flag;
+}
+
+static inline void
+store_cache (Store *store, uint32_t flag) {
+    __atomic_fetch_or(&store->flags, flag, __ATOMIC_RELEASE);
+}
+
 static inline Store*
 new_store (size_t cap, size_t len)
 {
     Store *store = malloc(STOREMEM(cap));
     if (!store) {ERR_ALLOC; return NULL;}
 
-    *store = (Store){
-        .cap = cap,
-        .len = len,
-        .refcnt = 1, 
-        .canary = CANARY,
-    };
+    // no struct assignment : sizeof(Store) may exceed a small allocation
+    store->cap = cap;
+    store->len = len;
+    store->refcnt = 1;
+    store->flags = 0;
+    store->hash = 0;
+    store->canary = CANARY;
 
     return store;
 }
 
+// A mapped store lives at the end of a header page, followed by the file 
+// pages then a zero page, so that data[len] is always readable and null.
+static inline size_t
+mapping_len (size_t cap, size_t pagesz) {
+    return pagesz + (cap + pagesz-1) / pagesz * pagesz + pagesz;
+}
+
+// Start of a mapped store's header page : 
+// the file if kept for sendfile() (BUFFET_MAP_KEEPFD), else -1
+typedef struct {
+    int fd;
+} MapHead;
+
+static inline MapHead*
+maphead (const Store *store) {
+    return (MapHead*)((char*)store + DATAOFF - sysconf(_SC_PAGESIZE));
+}
+
+static void
+release_store (Store *store)
+{
+    store->canary = 0;
+    LOG("free store");
+
+    if (store->flags & STORE_MAPPED) {
+        size_t pagesz = sysconf(_SC_PAGESIZE);
+        MapHead *head = maphead(store);
+        if (head->fd >= 0) close(head->fd);
+        munmap(head, mapping_len(store->cap, pagesz));
+    } else {
+        free(store);
+    }
+}
+
 static inline Buffet
 new_vue (const char *src, size_t len)
 {
@@ -120,6 +215,529 @@ dbg (const Buffet* buf)
     if (tag==OWN) dbgstore(getstore(buf));
 }
 
+// Make room for `extra` bytes after `buf` data.
+// In place if `buf` has room and is unique owner or at end, 
+// else by growing its store or relocating `buf`, growth by OVERALLOC.
+// Returns the write position, or NULL on error or insecure mutation.
+static char*
+reserve (Buffet *buf, size_t extra)
+{
+    const Tag tag = TAG(buf);
+    const char *curdata = getdata(buf, tag);
+    const size_t curlen = getlen(buf, tag);
+    const size_t newlen = curlen + extra;
+    Store *detached = NULL; // to release once data copied
+    BuffetSSO *target = NULL;
+
+    switch (tag) {
+
+        case SSO:
+            if (newlen <= BUFFET_SSOMAX) return buf->sso.data + curlen;
+            if (buf->sso.rfc) {
+                // Relocation would mutate `buf` to OWN
+                // while views still point directly into it.
+                WARN("Append would invalidate views on SSO\n");
+                return NULL;
+            }
+            break;
+
+        case OWN: {
+            Store *store = getstore(buf);
+            #if MEMCHECK
+                if (store->canary != CANARY) {
+                    WARN_CANARY;
+                    *buf = ZERO;
+                    return reserve(buf, extra);
+                }
+            #endif
+
+            size_t end = buf->ptr.off + curlen;
+            const bool alone = store->refcnt < 2;
+            const bool mapped = store->flags & STORE_MAPPED;
+
+            if (!mapped && (end+extra <= store->cap)
+                && (alone || end == store->len)) {
+                touch_store(store);
+                return buf->ptr.data + curlen;
+            }
+
+            if (alone && !mapped) {
+                touch_store(store);
+                // reclaim prefix left by consume(), if worth the move
+                if (buf->ptr.off >= curlen) {
+                    LOG("append OWN: compact");
+                    memmove(store->data, buf->ptr.data, curlen);
+                    buf->ptr.data = store->data;
+                    buf->ptr.off = 0;
+                    store->len = end = curlen;
+                    if (end+extra <= store->cap) return store->data + curlen;
+                }
+
+                LOG("append OWN: realloc");
+                size_t newcap = OVERALLOC*(end+extra);
+                store = realloc(store, STOREMEM(newcap));
+                if (!store) {ERR("append realloc\n"); return NULL;}
+                store->cap = newcap;
+                buf->ptr.data = store->data + buf->ptr.off;
+                return buf->ptr.data + curlen;
+            }
+
+            LOG("detach");
+            detached = store;
+            break;
+        }
+
+        case SSV: {
+            target = (BuffetSSO*)(buf->ptr.data - buf->ptr.off);
+            const size_t end = buf->ptr.off + curlen;
+            
+            if ((end+extra <= BUFFET_SSOMAX)
+                && (target->rfc < 2 || end == target->len)) {
+                return buf->ptr.data + curlen;
+            }
+            break;
+        }
+
+        case VUE:
+            break;
+    }
+
+    // relocate
+    if (newlen <= BUFFET_SSOMAX) {
+        Buffet sso = ZERO;
+        memcpy(sso.sso.data, curdata, curlen);
+        sso.sso.len = curlen;
+        *buf = sso;
+    } else {
+        Store *store = new_store(OVERALLOC*newlen, curlen);
+        if (!store) return NULL;
+        memcpy(store->data, curdata, curlen);
+        *buf = (Buffet) {
+            .ptr.data = store->data,
+            .ptr.len = curlen,
+            .ptr.off = 0,
+            .ptr.tag = OWN
+        };
+    }
+
+    if (detached && !--detached->refcnt) release_store(detached);
+    if (target) -- target->rfc;
+
+    return getdata(buf, TAG(buf)) + curlen;
+}
+
+// Account for `n` bytes written at the position returned by reserve().
+static void
+commit (Buffet *buf, size_t n)
+{
+    switch (TAG(buf)) {
+
+        case SSO:
+            buf->sso.len += n;
+            buf->sso.data[buf->sso.len] = 0;
+            break;
+
+        case OWN: {
+            Store *store = getstore(buf);
+            buf->ptr.len += n;
+            store->len = buf->ptr.off + buf->ptr.len;
+            store->data[store->len] = 0;
+            break;
+        }
+
+        case SSV: {
+            BuffetSSO *target = (BuffetSSO*)(buf->ptr.data - buf->ptr.off);
+            buf->ptr.len += n;
+            target->len = buf->ptr.off + buf->ptr.len;
+            target->data[target->len] = 0;
+            break;
+        }
+
+        case VUE:
+            break;
+    }
+}
+
+// Drop the last `n` committed bytes, undoing commit().
+static void
+uncommit (Buffet *buf, size_t n)
+{
+    switch (TAG(buf)) {
+
+        case SSO:
+            buf->sso.len -= n;
+            buf->sso.data[buf->sso.len] = 0;
+            break;
+
+        case OWN: {
+            Store *store = getstore(buf);
+            buf->ptr.len -= n;
+            store->len = buf->ptr.off + buf->ptr.len;
+            store->data[store->len] = 0;
+            break;
+        }
+
+        case SSV: {
+            BuffetSSO *target = (BuffetSSO*)(buf->ptr.data - buf->ptr.off);
+            buf->ptr.len -= n;
+            target->len = buf->ptr.off + buf->ptr.len;
+            target->data[target->len] = 0;
+            break;
+        }
+
+        case VUE:
+            break;
+    }
+}
+
+//============================================================================
+// SIMD kernels
+//============================================================================
+
+// Wide kernels are x86-64 only : SSE2 baseline, AVX2 picked at runtime.
+// Elsewhere, the scalar fallbacks.
+
+#ifdef SIMD_X86
+
+#define HAS_AVX2 __builtin_cpu_supports("avx2")
+
+// Equality of `len` >= 16 bytes, tail by an overlapping last load.
+static bool
+eq_sse2 (const char *a, const char *b, size_t len)
+{
+    #define EQ16(i) (_mm_movemask_epi8(_mm_cmpeq_epi8( \
+        _mm_loadu_si128((const __m128i*)(a+(i))), \
+        _mm_loadu_si128((const __m128i*)(b+(i))))) == 0xFFFF)
+
+    size_t i = 0;
+    for (; i+16 <= len; i += 16) if (!EQ16(i)) return false;
+    return i == len || EQ16(len-16);
+
+    #undef EQ16
+}
+
+// Equality of `len` >= 32 bytes, 128 per round, early exit.
+// Differences are or'ed, then tested once.
+__attribute__((target("avx2")))
+static bool
+eq_avx2 (const char *a, const char *b, size_t len)
+{
+    #define XOR32(i) _mm256_xor_si256( \
+        _mm256_loadu_si256((const __m256i*)(a+(i))), \
+        _mm256_loadu_si256((const __m256i*)(b+(i))))
+    #define NONE(m) _mm256_testz_si256(m, m)
+
+    size_t i = 0;
+    for (; i+128 <= len; i += 128) {
+        __m256i d = _mm256_or_si256(
+            _mm256_or_si256(XOR32(i), XOR32(i+32)), 
+            _mm256_or_si256(XOR32(i+64), XOR32(i+96)));
+        if (!NONE(d)) return false;
+    }
+
+    __m256i d = XOR32(len-32); // overlapping tail
+    for (; i+32 <= len; i += 32) d = _mm256_or_si256(d, XOR32(i));
+    return NONE(d);
+
+    #undef XOR32
+    #undef NONE
+}
+
+#endif
+
+// Equality of byte arrays.
+// Long ones go to libc memcmp, as vectorized and aligning its loads.
+static inline bool
+eq_bytes (const char *a, const char *b, size_t len)
+{
+    #ifdef SIMD_X86
+    if (len > 1024) return !memcmp(a, b, len);
+    if (len >= 32 && HAS_AVX2) return eq_avx2(a, b, len);
+    if (len >= 16) return eq_sse2(a, b, len);
+    #endif
+    return !memcmp(a, b, len);
+}
+
+// Equality of two SSO payloads of `len` bytes, 
+// by two loads covering the whole data array, masked to `len`.
+static inline bool
+eq_sso (const BuffetSSO *a, const BuffetSSO *b, size_t len)
+{
+    #ifdef SIMD_X86
+    enum {HI = sizeof(a->data)-16};
+    const __m128i alo = _mm_loadu_si128((const __m128i*)a->data);
+    const __m128i blo = _mm_loadu_si128((const __m128i*)b->data);
+    const __m128i ahi = _mm_loadu_si128((const __m128i*)(a->data+HI));
+    const __m128i bhi = _mm_loadu_si128((const __m128i*)(b->data+HI));
+    const uint32_t neq = 
+        (~_mm_movemask_epi8(_mm_cmpeq_epi8(alo, blo)) & 0xFFFF)
+      | (~_mm_movemask_epi8(_mm_cmpeq_epi8(ahi, bhi)) & 0xFFFF) << HI;
+    return !(neq & ((1u << len) - 1));
+    #else
+    return !memcmp(a->data, b->data, len);
+    #endif
+}
+
+// ASCII case : bytes in ['A','Z'] (or ['a','z']) have bit 0x20 flipped.
+// `from` is the first letter of the case to convert.
+static inline char
+case_byte (char c, char from) {
+    return c ^ (((unsigned char)(c - from) < 26) << 5);
+}
+
+#ifdef SIMD_X86
+
+static void
+case_sse2 (char *p, size_t len, char from)
+{
+    const __m128i lo = _mm_set1_epi8(from);
+    const __m128i top = _mm_set1_epi8(25);
+    const __m128i bit = _mm_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i+16 <= len; i += 16) {
+        __m128i *at = (__m128i*)(p+i);
+        const __m128i c = _mm_loadu_si128(at);
+        const __m128i v = _mm_sub_epi8(c, lo);
+        const __m128i in = _mm_cmpeq_epi8(_mm_min_epu8(v, top), v);
+        _mm_storeu_si128(at, _mm_xor_si128(c, _mm_and_si128(in, bit)));
+    }
+    for (; i < len; ++i) p[i] = case_byte(p[i], from);
+}
+
+__attribute__((target("avx2")))
+static void
+case_avx2 (char *p, size_t len, char from)
+{
+    const __m256i lo = _mm256_set1_epi8(from);
+    const __m256i top = _mm256_set1_epi8(25);
+    const __m256i bit = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+
+    for (; i+32 <= len; i += 32) {
+        __m256i *at = (__m256i*)(p+i);
+        const __m256i c = _mm256_loadu_si256(at);
+        const __m256i v = _mm256_sub_epi8(c, lo);
+        const __m256i in = _mm256_cmpeq_epi8(_mm256_min_epu8(v, top), v);
+        _mm256_storeu_si256(at, _mm256_xor_si256(c, _mm256_and_si256(in, bit)));
+    }
+    case_sse2(p+i, len-i, from);
+}
+
+#endif
+
+// Convert `len` bytes in place, to lower if `from` is 'A', to upper if 'a'.
+static void
+case_bytes (char *p, size_t len, char from)
+{
+    #ifdef SIMD_X86
+    if (len >= 32 && HAS_AVX2) {case_avx2(p, len, from); return;}
+    case_sse2(p, len, from);
+    #else
+    for (size_t i = 0; i < len; ++i) p[i] = case_byte(p[i], from);
+    #endif
+}
+
+// Case-insensitive memcmp : first differing bytes once lowered.
+static int
+casecmp_bytes (const char *a, const char *b, size_t len)
+{
+    size_t i = 0;
+
+    #ifdef SIMD_X86
+    const __m128i lo = _mm_set1_epi8('A');
+    const __m128i top = _mm_set1_epi8(25);
+    const __m128i bit = _mm_set1_epi8(0x20);
+    #define LOWER16(c) _mm_xor_si128(c, _mm_and_si128(bit, _mm_cmpeq_epi8( \
+        _mm_min_epu8(_mm_sub_epi8(c, lo), top), _mm_sub_epi8(c, lo))))
+
+    for (; i+16 <= len; i += 16) {
+        const __m128i ca = _mm_loadu_si128((const __m128i*)(a+i));
+        const __m128i cb = _mm_loadu_si128((const __m128i*)(b+i));
+        const unsigned eq = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(LOWER16(ca), LOWER16(cb)));
+        if (eq != 0xFFFF) {i += __builtin_ctz(~eq); break;}
+    }
+
+    #undef LOWER16
+    #endif
+
+    for (; i < len; ++i) {
+        const unsigned char ca = case_byte(a[i], 'A');
+        const unsigned char cb = case_byte(b[i], 'A');
+        if (ca != cb) return ca - cb;
+    }
+    return 0;
+}
+
+#ifdef SIMD_X86
+
+// Candidates : positions where the first and last needle bytes match, 
+// 16 at a time, each confirmed by memcmp. `nlen` >= 2.
+static size_t
+find_sse2 (const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    const __m128i first = _mm_set1_epi8(n[0]);
+    const __m128i last = _mm_set1_epi8(n[nlen-1]);
+    size_t i = 0;
+
+    for (; i+nlen-1+16 <= hlen; i += 16) {
+        const __m128i f = _mm_loadu_si128((const __m128i*)(h+i));
+        const __m128i l = _mm_loadu_si128((const __m128i*)(h+i+nlen-1));
+        unsigned m = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(f, first), _mm_cmpeq_epi8(l, last)));
+        for (; m; m &= m-1) {
+            const size_t at = i + __builtin_ctz(m);
+            if (!memcmp(h+at+1, n+1, nlen-2)) return at;
+        }
+    }
+
+    const char *at = memmem(h+i, hlen-i, n, nlen);
+    return at ? (size_t)(at-h) : hlen;
+}
+
+// Same as find_sse2(), 32 at a time.
+__attribute__((target("avx2")))
+static size_t
+find_avx2 (const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    const __m256i first = _mm256_set1_epi8(n[0]);
+    const __m256i last = _mm256_set1_epi8(n[nlen-1]);
+    size_t i = 0;
+
+    for (; i+nlen-1+32 <= hlen; i += 32) {
+        const __m256i f = _mm256_loadu_si256((const __m256i*)(h+i));
+        const __m256i l = _mm256_loadu_si256((const __m256i*)(h+i+nlen-1));
+        uint32_t m = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(f, first), _mm256_cmpeq_epi8(l, last)));
+        for (; m; m &= m-1) {
+            const size_t at = i + __builtin_ctz(m);
+            if (!memcmp(h+at+1, n+1, nlen-2)) return at;
+        }
+    }
+
+    return i + find_sse2(h+i, hlen-i, n, nlen);
+}
+
+#endif
+
+// Offset of the first `n` in `h`, `hlen` if none. `nlen` > 0.
+static size_t
+find_bytes (const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    if (nlen > hlen) return hlen;
+    if (nlen == 1) {
+        const char *at = memchr(h, n[0], hlen);
+        return at ? (size_t)(at-h) : hlen;
+    }
+
+    #ifdef SIMD_X86
+    if (HAS_AVX2) return find_avx2(h, hlen, n, nlen);
+    return find_sse2(h, hlen, n, nlen);
+    #else
+    const char *at = memmem(h, hlen, n, nlen);
+    return at ? (size_t)(at-h) : hlen;
+    #endif
+}
+
+// C locale isspace()
+static inline bool
+is_space (char c) {
+    return c == ' ' || (unsigned char)(c - '\t') < 5;
+}
+
+#ifdef SIMD_X86
+
+static inline __m128i
+space_sse2 (__m128i c)
+{
+    const __m128i ctl = _mm_sub_epi8(c, _mm_set1_epi8('\t'));
+    return _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+        _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8(4)), ctl));
+}
+
+static uint64_t
+space_mask_sse2 (const char *p)
+{
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i += 16) {
+        const __m128i c = _mm_loadu_si128((const __m128i*)(p+i));
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(space_sse2(c)) << i;
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static uint64_t
+space_mask_avx2 (const char *p)
+{
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i four = _mm256_set1_epi8(4);
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i += 32) {
+        const __m256i c = _mm256_loadu_si256((const __m256i*)(p+i));
+        const __m256i ctl = _mm256_sub_epi8(c, tab);
+        const __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(c, sp),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(ctl, four), ctl));
+        m |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << i;
+    }
+    return m;
+}
+
+#endif
+
+// Bit i set if p[i] is whitespace, for `len` bytes up to 64. 
+// Bits past `len` are set, as if padded with spaces.
+static uint64_t
+space_mask (const char *p, size_t len)
+{
+    char pad[64];
+    if (len < 64) {
+        memset(pad, ' ', 64);
+        memcpy(pad, p, len);
+        p = pad;
+    }
+
+    #ifdef SIMD_X86
+    if (HAS_AVX2) return space_mask_avx2(p);
+    return space_mask_sse2(p);
+    #else
+    uint64_t m = 0;
+    for (int i = 0; i < 64; ++i) m |= (uint64_t)is_space(p[i]) << i;
+    return m;
+    #endif
+}
+
+// Length of the leading run of whitespace if `space`, else of non-space.
+static size_t
+space_span (const char *p, size_t len, bool space)
+{
+    for (size_t i = 0; i < len; i += 64) {
+        const uint64_t m = space_mask(p+i, len-i);
+        const uint64_t stop = space ? ~m : m;
+        if (stop) {
+            const size_t at = i + __builtin_ctzll(stop);
+            return at < len ? at : len;
+        }
+    }
+    return len;
+}
+
+// Length without trailing whitespace.
+static size_t
+space_rtrim (const char *p, size_t len)
+{
+    for (size_t end = len; end; ) {
+        const size_t n = end < 64 ? end : 64;
+        const uint64_t word = ~space_mask(p+end-n, n);
+        const uint64_t m = n < 64 ? word & ((1ull << n) - 1) : word;
+        if (m) return end-n + 64 - __builtin_clzll(m);
+        end -= n;
+    }
+    return 0;
+}
+
 //============================================================================
 // Public
 //============================================================================
@@ -189,6 +807,74 @@ bft_memview (const char *src, size_t len) {
     return new_vue(src, len);
 }
 
+/**
+ * Create a new Buffet owning a read-only mapping of a file.
+ * The mapping is released with its last co-owner.
+ * Appending to it detaches into a heap copy.
+ * The file is closed once mapped, unless BUFFET_MAP_KEEPFD keeps it open
+ * (until the last co-owner) for bft_sendfile().
+ * 
+ * @param[in] path the file path
+ * @param[in] advice BUFFET_MAP_SEQUENTIAL, BUFFET_MAP_WILLNEED, 
+ *  BUFFET_MAP_KEEPFD
+ * @return OWN Buffet, or empty Buffet on error or empty file
+ */
+Buffet
+bft_mapfile (const char *path, int advice)
+{
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {ERR("cannot open %s\n", path); return ZERO;}
+
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+        close(fd);
+        return ZERO;
+    }
+
+    const size_t len = st.st_size;
+    const size_t pagesz = sysconf(_SC_PAGESIZE);
+    const size_t maplen = mapping_len(len, pagesz);
+
+    // reserve the whole range, then overlay the file
+    char *base = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {close(fd); ERR_ALLOC; return ZERO;}
+
+    char *data = base + pagesz;
+    if (mprotect(base, pagesz, PROT_READ|PROT_WRITE)
+    || mmap(data, len, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED) {
+        ERR("cannot map %s\n", path);
+        munmap(base, maplen);
+        close(fd);
+        return ZERO;
+    }
+
+    if (advice & BUFFET_MAP_KEEPFD) {
+        ((MapHead*)base)->fd = fd;
+    } else {
+        ((MapHead*)base)->fd = -1;
+        close(fd);
+    }
+
+    if (advice & BUFFET_MAP_SEQUENTIAL) madvise(data, len, MADV_SEQUENTIAL);
+    if (advice & BUFFET_MAP_WILLNEED) madvise(data, len, MADV_WILLNEED);
+
+    // no struct assignment : sizeof(Store) spans into data
+    Store *store = (Store*)(data - DATAOFF);
+    store->cap = len;
+    store->len = len;
+    store->refcnt = 1;
+    store->flags = STORE_MAPPED;
+    store->hash = 0;
+    store->canary = CANARY;
+
+    return (Buffet) {
+        .ptr.data = data,
+        .ptr.len = len,
+        .ptr.off = 0,
+        .ptr.tag = OWN
+    };
+}
+
 /**
  * Create a new Buffet copying a Buffet's data
  * @param[in] src the source Buffet
@@ -343,11 +1029,7 @@ bft_free (Buffet *buf)
 
         -- store->refcnt;
 
-        if (!store->refcnt) {
-            store->canary = 0;
-            LOG("free store");
-            free(store);
-        }
+        if (!store->refcnt) release_store(store);
 
     } else if (tag==SSV) {
         // check ? No, fault would be user losing scope
@@ -433,14 +1115,16 @@ bft_cat (Buffet *dst, const Buffet *buf, const char *src, size_t srclen)
             #endif
 
             bool alone = store->refcnt < 2;
+            bool mapped = store->flags & STORE_MAPPED;
 
             // in-place optimization:
             // if store has room and `buf` is unique owner or at end,
             // we append in place and return a view.
-            if ((writeoff+srclen <= store->cap)
+            if (!mapped && (writeoff+srclen <= store->cap)
                 && (alone || writeoff == store->len)) {
 
                 //LOG("cat OWN: inplace");
+                touch_store(store);
                 writer = store->data + writeoff;
                 memcpy(writer, src, srclen);
                 writer[srclen] = 0;
@@ -516,157 +1200,122 @@ bft_cat (Buffet *dst, const Buffet *buf, const char *src, size_t srclen)
 size_t
 bft_append (Buffet *buf, const char *src, size_t srclen)
 {
-    Tag tag = TAG(buf);
-    const char *curdata;
-    char *writer = NULL;
-    Store *store = NULL;
-    size_t curlen;
-    size_t newlen;
-    size_t writeoff = 0;
-    bool ssofit = false;
+    char *writer = reserve(buf, srclen);
+    if (!writer) return 0;
 
-    if (tag == SSO) {
+    memcpy(writer, src, srclen);
+    commit(buf, srclen);
 
-        curdata = (char*)buf->sso.data;
-        curlen = buf->sso.len;
-        newlen = curlen + srclen;
-        ssofit = (newlen <= BUFFET_SSOMAX);
+    return getlen(buf, TAG(buf));
+}
 
-        if (ssofit) {
 
-            writer = (char*)curdata+curlen;
-            memcpy(writer, src, srclen);
-            writer[srclen] = 0;
-            buf->sso.len = newlen;
-            return newlen;
-        
-        } else if (buf->sso.rfc) {
-            // Relocation would mutate `buf` to OWN
-            // while views still point directly into it.
-            WARN("Append would invalidate views on SSO\n");
-            return 0;
-        }
-    
-    } else {
 
-        curdata = buf->ptr.data;
-        curlen = buf->ptr.len;
-        newlen = curlen + srclen;
-        writeoff = buf->ptr.off + curlen;
-        ssofit = (newlen <= BUFFET_SSOMAX);
+/**
+ * Read from a file descriptor directly into a Buffet's spare capacity.
+ * Room for `maxlen` bytes is reserved like bft_append() would, 
+ * but only the bytes read are added to the Buffet length.
+ *
+ * @param[in,out] buf the destination Buffet
+ * @param[in] fd the source file descriptor
+ * @param[in] maxlen the maximum number of bytes to read
+ * @return bytes read, 0 at end of input, -1 on error
+*/
+ssize_t
+bft_read_fd (Buffet *buf, int fd, size_t maxlen)
+{
+    char *writer = reserve(buf, maxlen);
+    if (!writer) {errno = ENOMEM; return -1;}
 
-        if (tag == OWN) {
+    ssize_t got;
+    do got = read(fd, writer, maxlen);
+    while (got < 0 && errno == EINTR);
 
-            store = getstore(buf);
-            #if MEMCHECK
-                if (store->canary != CANARY) {
-                    WARN_CANARY;
-                    // return 0;
-                    *buf = bft_memcopy(src, srclen);
-                    return srclen;
-                }
-            #endif
-
-            bool alone = store->refcnt < 2;
-
-            // append in-place: only if store has room
-            // and (`buf` is unique owner or at end).
-            if ((writeoff+srclen <= store->cap)
-                && (alone || writeoff == store->len)) {
+    if (got > 0) commit(buf, got);
+    return got;
+}
 
-                //LOG("append OWN: inplace");
-                writer = store->data + writeoff;
-                memcpy(writer, src, srclen);
-                writer[srclen] = 0;
-                store->len = writeoff+srclen;   
-                buf->ptr.len = newlen;
+/**
+ * Like bft_read_fd(), reading at a file offset with pread().
+ *
+ * @param[in,out] buf the destination Buffet
+ * @param[in] fd the source file descriptor
+ * @param[in] maxlen the maximum number of bytes to read
+ * @param[in] off the file offset
+ * @return bytes read, 0 at end of file, -1 on error
+*/
+ssize_t
+bft_pread (Buffet *buf, int fd, size_t maxlen, off_t off)
+{
+    char *writer = reserve(buf, maxlen);
+    if (!writer) {errno = ENOMEM; return -1;}
 
-                return newlen;
-            
-            // realloc store
-            } else if (alone) {
-                // optim: shift left if off=0 ?
-                LOG("append OWN: realloc");
-                size_t newcap = writeoff + OVERALLOC*srclen;
-                store = realloc(store, STOREMEM(newcap));
-                if (!store) {
-                    ERR("append realloc\n");
-                    return 0;
-                }
-                writer = store->data + writeoff;
-                goto appn;
-            
-            // detach
-            } else {
-                LOG("detach");
-                assert(store->refcnt);
-                -- store->refcnt; // check ?
-                // todo: way to adjust end*
-            }
+    ssize_t got;
+    do got = pread(fd, writer, maxlen, off);
+    while (got < 0 && errno == EINTR);
 
-        
-        } else if (tag==SSV) {
+    if (got > 0) commit(buf, got);
+    return got;
+}
 
-            BuffetSSO *target = (BuffetSSO*)(buf->ptr.data - buf->ptr.off);
-            bool alone = target->rfc < 2;
-            
-            // overdone ?
-            // Append in-place: only if sso has room
-            // and `buf` is unique view or at end.
-            if ((writeoff+srclen <= BUFFET_SSOMAX)
-                && (alone || writeoff == target->len)) {
-
-                //LOG("append SSV: inplace");
-                writer = target->data + writeoff;
-                memcpy(writer, src, srclen);
-                writer[srclen] = 0;
-                target->len = writeoff+srclen;
-                buf->ptr.len = newlen;
-                return newlen;
-            }
+/**
+ * Like bft_read_fd(), receiving from a socket with recv().
+ *
+ * @param[in,out] buf the destination Buffet
+ * @param[in] sockfd the source socket
+ * @param[in] maxlen the maximum number of bytes to receive
+ * @param[in] flags recv() flags
+ * @return bytes received, 0 on shutdown, -1 on error
+*/
+ssize_t
+bft_recv (Buffet *buf, int sockfd, size_t maxlen, int flags)
+{
+    char *writer = reserve(buf, maxlen);
+    if (!writer) {errno = ENOMEM; return -1;}
 
-            // detach
-            -- target->rfc;
-        }
-    } // end case ptr
+    ssize_t got;
+    do got = recv(sockfd, writer, maxlen, flags);
+    while (got < 0 && errno == EINTR);
 
-    if (ssofit) {
+    if (got > 0) commit(buf, got);
+    return got;
+}
 
-        // assert(tag!=SSO);
-        // LOG("ssofit");
-        TAG(buf) = SSO;
-        buf->sso.len = newlen;
-        buf->sso.rfc = 0;
+/**
+ * Drop bytes from the front of a Buffet, without moving data.
+ * Appending to a unique owner later reclaims the consumed prefix
+ * once it is at least as large as the remaining data.
+ * An SSO is shifted, unless it has views.
+ *
+ * @param[in,out] buf the Buffet
+ * @param[in] n the number of bytes to drop, clipped to the length
+ * @return the Buffet new length
+*/
+size_t
+bft_consume (Buffet *buf, size_t n)
+{
+    const Tag tag = TAG(buf);
+    const size_t len = getlen(buf, tag);
 
-        writer = buf->sso.data;
-        memcpy(writer, curdata, curlen);
-        writer += curlen;
-        memcpy(writer, src, srclen);
-        writer[srclen] = 0;
+    if (n > len) n = len;
 
-        return newlen;
+    if (tag == SSO) {
+        if (buf->sso.rfc) {
+            WARN("Consume would invalidate views on SSO\n");
+            return len;
+        }
+        memmove(buf->sso.data, buf->sso.data + n, len-n+1);
+        buf->sso.len = len-n;
+        return len-n;
     }
 
-    store = new_store(OVERALLOC*newlen, newlen);
-    if (!store) {return 0;}
-
-    writer = store->data;
-    memcpy(writer, curdata, curlen);
-    writer += curlen;
-
-    TAG(buf) = OWN;
-    buf->ptr.off = 0;
-appn:
-    memcpy(writer, src, srclen);
-    writer[srclen] = 0;
-    buf->ptr.data = store->data;
-    buf->ptr.len = newlen;
+    buf->ptr.data += n;
+    buf->ptr.len -= n;
+    if (tag != VUE) buf->ptr.off += n;
 
-    return newlen;               
+    return len-n;
 }
 
-
-
 #define LIST_STACK_MAX (BUFFET_STACK_MEM/sizeof(Buffet))
 
 /**
@@ -710,7 +1359,8 @@ bft_split (const char* src, size_t srclen, const char* sep, size_t seplen,
                 parts_alloc = parts;
             } else {
                 parts = realloc(parts, newsz); 
-                if (!parts) {curcnt = 0; goto fin;}
+                if (!parts) {free(parts_alloc); curcnt = 0; goto fin;}
+                parts_alloc = parts;
             }
         }
 
@@ -763,6 +1413,8 @@ bft_splitstr (const char* src, const char* sep, int *outcnt) {
 Buffet 
 bft_join (const Buffet *parts, int cnt, const char* sep, size_t seplen)
 {
+    if (cnt >= BUFFET_PAR_JOIN_MIN) return bft_par_join(parts, cnt, sep, seplen);
+
     // optim: local if small; none if too big ?
     size_t *lengths = malloc(cnt*sizeof(*lengths));
     size_t totlen = 0;
@@ -804,156 +1456,5496 @@ bft_join (const Buffet *parts, int cnt, const char* sep, size_t seplen)
 
 
 /**
- * Compare two buffets' data using memcmp.
- * 
- * @param[in] a the first Buffet
- * @param[in] b the second Buffet
- * @return same logic as memcmp : 0 if equal, signed bytes diff otherwise
- */
-int
-bft_cmp (const Buffet *a, const Buffet *b)
+ * Describe a list of Buffets as an iovec array, without copy.
+ *
+ * @param[in] parts the Buffet source array
+ * @param[in] cnt the source array length
+ * @param[out] iov the iovec array of `cnt` entries to fill
+ * @return the total length in bytes
+*/
+size_t
+bft_to_iovec (const Buffet *parts, int cnt, struct iovec *iov)
 {
-    if (a==b) return 0;
-
-    Tag taga = TAG(a);
-    Tag tagb = TAG(b);
-    size_t lena = getlen(a, taga);
-    size_t lenb = getlen(b, tagb);
-    intmax_t lendiff = lena-lenb; //?
-    const char *dataa = getdata(a, taga);
-    const char *datab = getdata(b, tagb);
+    size_t totlen = 0;
 
-    if (!lendiff) {
-        if (dataa==datab) return 0;
-        return memcmp(dataa, datab, lena);
+    for (int i = 0; i < cnt; ++i) {
+        const Buffet *part = &parts[i];
+        const Tag tag = TAG(part);
+        const size_t len = getlen(part, tag);
+        iov[i].iov_base = getdata(part, tag);
+        iov[i].iov_len = len;
+        totlen += len;
     }
-    
-    size_t minlen = (lendiff<0) ? lena : lenb;
-    int cmp = memcmp(dataa, datab, minlen);
-    if (cmp) return cmp;
 
-    return lendiff;
+    return totlen;
 }
 
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#define IOV_BATCH (IOV_MAX < 1024 ? IOV_MAX : 1024)
+
 /**
- * Get a Buffet data as a null-terminated C string of length buf.len.
- * 
- * @param[in] buf the Buffet source
- * @param[out] mustfree output flag set if the return must be freed
- * @return the c-string data
- */
-const char*
-bft_cstr (const Buffet *buf, bool *mustfree) 
+ * Write a list of Buffets to a file descriptor with writev(), without join.
+ * Short writes are resumed, lists longer than IOV_MAX are batched.
+ *
+ * @param[in] fd the destination file descriptor
+ * @param[in] parts the Buffet source array
+ * @param[in] cnt the source array length
+ * @return bytes written, or -1 on error if nothing was written
+*/
+ssize_t
+bft_writev (int fd, const Buffet *parts, int cnt)
 {
-    Tag tag = TAG(buf);
-    const size_t len = getlen(buf, tag);
-    bool tofree = false;
-    char *ret = NULL;
+    struct iovec iov[IOV_BATCH];
+    size_t done = 0;
+    size_t skip = 0; // bytes of parts[i] already written
+    int i = 0;
+
+    for (;;) {
+
+        // batch next non-empty parts
+        int n = 0;
+        for (int j = i; j < cnt && n < IOV_BATCH; ++j) {
+            const Buffet *part = &parts[j];
+            const Tag tag = TAG(part);
+            size_t len = getlen(part, tag);
+            if (j==i) len -= skip;
+            if (!len) continue;
+            iov[n].iov_base = getdata(part, tag) + (j==i ? skip : 0);
+            iov[n].iov_len = len;
+            ++n;
+        }
 
-    if (!len) {
-        ret = ""; //calloc(1) ?
-    } else if (tag==SSO) {
-        ret = (char*)buf->sso.data;
-    } else {
-        const char *data = buf->ptr.data;
-        if (data[len]==0) {
-            ret = (char*)data;
-        } else {
-            ret = malloc(len+1);
-            if (!ret) {
-                ERR_ALLOC;
-                ret = calloc(1,1);
-            } else {
-                memcpy(ret, data, len);
-                ret[len] = 0;
-            }
-            tofree = true;
-        }               
+        if (!n) break;
+
+        ssize_t rc = writev(fd, iov, n);
+        
+        if (rc <= 0) {
+            if (rc && errno == EINTR) continue;
+            return done ? (ssize_t)done : -1;
+        }
+
+        done += rc;
+
+        // advance over written bytes
+        size_t w = rc;
+        while (i < cnt) {
+            size_t rem = bft_len(&parts[i]) - skip;
+            if (w < rem) {skip += w; break;}
+            w -= rem;
+            skip = 0;
+            ++i;
+        }
     }
 
-    *mustfree = tofree;
-    return ret;
+    return done;
 }
 
 
-/**
- * Get a null-terminated copy of a Buffet data.
- * @param[in] buf the Buffet source
- * @return string copy that must be freed, or NULL on error
- */
-char*
-bft_export (const Buffet* buf) 
+//============================================================================
+// Zero-copy transfer
+//============================================================================
+
+// write() all of `data`, resuming on EINTR and short writes.
+static ssize_t
+write_all (int fd, const char *data, size_t len)
 {
-    const Tag tag = TAG(buf);
-    const size_t len = getlen(buf,tag);
-    const char* data = getdata(buf,tag);
-    char* ret = malloc(len+1);
+    size_t done = 0;
 
-    if (!ret) {
-        ERR_ALLOC; return NULL;
-    } else {
-        memcpy(ret, data, len);
+    while (done < len) {
+        ssize_t rc = write(fd, data+done, len-done);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc <= 0) return done ? (ssize_t)done : -1;
+        done += rc;
     }
 
-    ret[len] = 0;
-    return ret;
+    return done;
 }
 
+#ifdef __linux__
 
-/**
- * Get a Buffet read-only data pointer.
- * @param[in] buf the Buffet source
- */
-const char*
-bft_data (const Buffet* buf) {
-    return getdata(buf, TAG(buf));
+// Errors by which the splice family refuses an fd, worth a write() fallback.
+static inline bool
+splice_unsupported (int err) {
+    return err==EINVAL || err==ENOSYS || err==EBADF || err==EOPNOTSUPP;
 }
 
-/**
- * Get a Buffet length.
- * @param[in] buf the Buffet source
- */
-size_t
-bft_len (const Buffet* buf) {
-    return getlen(buf, TAG(buf));
+// vmsplice() `data` into pipe `pipefd`.
+// Returns bytes transferred, or -1 if nothing was.
+static ssize_t
+vmsplice_all (int pipefd, const char *data, size_t len, unsigned flags)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        struct iovec iov = {(void*)(data+done), len-done};
+        ssize_t rc = vmsplice(pipefd, &iov, 1, flags);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc <= 0) return done ? (ssize_t)done : -1;
+        done += rc;
+    }
+
+    return done;
+}
+
+// Move `data` pages to `fd` through a private pipe : 
+// vmsplice() what the pipe takes, splice() it out, repeat.
+// Returns bytes transferred, or -1 if nothing was.
+static ssize_t
+splice_pages (int fd, const char *data, size_t len)
+{
+    int pfd[2];
+    if (pipe2(pfd, O_CLOEXEC|O_NONBLOCK)) return -1;
+
+    size_t done = 0;
+
+    while (done < len) {
+
+        ssize_t in = vmsplice_all(pfd[1], data+done, len-done, 
+            SPLICE_F_NONBLOCK);
+        if (in < 0) break;
+
+        // drain the pipe, or lose track of what reached `fd`
+        while (in) {
+            ssize_t rc = splice(pfd[0], NULL, fd, NULL, in, SPLICE_F_MOVE);
+            if (rc < 0 && errno == EINTR) continue;
+            if (rc <= 0) goto end;
+            in -= rc;
+            done += rc;
+        }
+    }
+
+    end:;
+    int err = errno;
+    close(pfd[0]);
+    close(pfd[1]);
+    errno = err;
+
+    return done ? (ssize_t)done : -1;
+}
+
+#endif
+
+// File kept open by the bft_mapfile() store of `buf`, else -1.
+static inline int
+mapped_fd (const Buffet *buf) {
+    if (TAG(buf)!=OWN || !(getstore(buf)->flags & STORE_MAPPED)) return -1;
+    return maphead(getstore(buf))->fd;
 }
 
 /**
- * Get a Buffet total capacity.
+ * Transfer a Buffet's bytes into a pipe with vmsplice(), without copy.
+ * The pipe then references the store pages : `pin` receives a co-owner 
+ * of the store, keeping it alive and unmodified, to be freed only once 
+ * the pipe reader has consumed the data.
+ * SSO and views, or a refusing kernel, fall back to write(), 
+ * with `pin` set to empty.
+ *
+ * @param[in] pipefd the pipe write end
  * @param[in] buf the Buffet source
- */
-size_t
-bft_cap (const Buffet* buf) {
-    Tag tag = TAG(buf);
-    if (tag==SSO) return BUFFET_SSOMAX;
-    if (tag==OWN) {
-        Store* store = getstore(buf);
-        #if MEMCHECK
-            if (store->canary != CANARY) {WARN_CANARY; return 0;}
-        #endif
+ * @param[out] pin the pinning co-owner, or NULL if unneeded
+ * @return bytes transferred, or -1 on error if nothing was
+*/
+ssize_t
+bft_vmsplice (int pipefd, const Buffet *buf, Buffet *pin)
+{
+    const Tag tag = TAG(buf);
+    const char *data = getdata(buf, tag);
+    const size_t len = getlen(buf, tag);
 
-        return store->cap;
+    if (pin) *pin = ZERO;
+    if (!len) return 0;
+
+    #ifdef __linux__
+    if (tag==OWN) {
+        ssize_t rc = vmsplice_all(pipefd, data, len, 0);
+        if (rc > 0) {
+            if (pin) *pin = bft_dup(buf);
+            return rc;
+        }
+        if (!splice_unsupported(errno)) return -1;
     }
-    return 0;
+    #endif
+
+    return write_all(pipefd, data, len);
 }
 
 /**
- * Print a Buffet data
- * @param[in] buf the Buffet source
- */
-void
-bft_print (const Buffet *buf) {
-    Tag tag = TAG(buf);
-    printf("%.*s\n", (int)getlen(buf,tag), getdata(buf,tag));
-    fflush(stdout);
+ * Send a mapped-file Buffet to a file descriptor with sendfile(), 
+ * straight from the page cache.
+ * Other Buffets, mappings without BUFFET_MAP_KEEPFD, or a refusing kernel,
+ * fall back to write().
+ *
+ * @param[in] fd the destination file descriptor
+ * @param[in] buf the Buffet source, normally from bft_mapfile()
+ * @return bytes sent, or -1 on error if nothing was
+*/
+ssize_t
+bft_sendfile (int fd, const Buffet *buf)
+{
+    const Tag tag = TAG(buf);
+    const char *data = getdata(buf, tag);
+    const size_t len = getlen(buf, tag);
+
+    if (!len) return 0;
+
+    #ifdef __linux__
+    const int src = mapped_fd(buf);
+    if (src >= 0) {
+        off_t off = buf->ptr.off; // store data is the file from 0
+        size_t done = 0;
+
+        while (done < len) {
+            ssize_t rc = sendfile(fd, src, &off, len-done);
+            if (rc < 0 && errno == EINTR) continue;
+            if (rc <= 0) break;
+            done += rc;
+        }
+
+        if (done == len) return done;
+        if (done || !splice_unsupported(errno)) return done ? (ssize_t)done : -1;
+    }
+    #endif
+
+    return write_all(fd, data, len);
 }
 
 /**
- * Print a Buffet state.
+ * Transfer a Buffet's bytes to a file descriptor (socket, file, pipe) 
+ * without user-space copy :
+ * sendfile() for a file mapped with BUFFET_MAP_KEEPFD, 
+ * else vmsplice() through a pipe and splice().
+ * As with bft_vmsplice(), `pin` receives a co-owner of the store 
+ * whose pages the kernel may still reference (socket buffers), 
+ * to be freed once the peer has received the data.
+ * SSO and views, or a refusing kernel, fall back to write(), 
+ * with `pin` set to empty.
+ *
+ * @param[in] fd the destination file descriptor
  * @param[in] buf the Buffet source
- */
-void 
-bft_dbg (const Buffet* buf) {
-    dbg(buf);
+ * @param[out] pin the pinning co-owner, or NULL if unneeded
+ * @return bytes transferred, or -1 on error if nothing was
+*/
+ssize_t
+bft_splice (int fd, const Buffet *buf, Buffet *pin)
+{
+    const Tag tag = TAG(buf);
+    const char *data = getdata(buf, tag);
+    const size_t len = getlen(buf, tag);
+
+    if (pin) *pin = ZERO;
+    if (!len) return 0;
+
+    if (mapped_fd(buf) >= 0) return bft_sendfile(fd, buf);
+
+    #ifdef __linux__
+    if (tag==OWN) {
+        ssize_t rc = splice_pages(fd, data, len);
+        if (rc > 0) {
+            if (pin) *pin = bft_dup(buf);
+            if ((size_t)rc == len) return rc;
+            // resume what splice left
+            ssize_t more = write_all(fd, data+rc, len-rc);
+            return more > 0 ? rc+more : rc;
+        }
+        if (!splice_unsupported(errno)) return -1;
+    }
+    #endif
+
+    return write_all(fd, data, len);
+}
+
+
+//============================================================================
+// Persistence
+//============================================================================
+
+// File layout, native endianness : 
+// header, index of cnt {off,len} into blob, blob of null-terminated parts.
+typedef struct {
+    char     magic[4];
+    uint32_t version;   // also detects foreign endianness
+    uint64_t cnt;
+    uint64_t bloblen;
+    uint64_t reserved;
+} FileHeader;
+
+typedef struct {
+    uint64_t off;
+    uint64_t len;
+} FileEntry;
+
+#define FILE_MAGIC "BFTA"
+#define FILE_VERSION 1
+
+/**
+ * Save a list of Buffets to a file that bft_load() maps back without copy.
+ *
+ * @param[in] path the destination file path
+ * @param[in] parts the Buffet source array
+ * @param[in] cnt the source array length
+ * @return 0 on success, -1 on error
+*/
+int
+bft_save (const char *path, const Buffet *parts, int cnt)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file) {ERR("cannot open %s\n", path); return -1;}
+
+    FileHeader head = {
+        .magic = FILE_MAGIC,
+        .version = FILE_VERSION,
+        .cnt = cnt,
+    };
+
+    for (int i = 0; i < cnt; ++i) head.bloblen += bft_len(&parts[i]) + 1;
+    fwrite(&head, sizeof(head), 1, file);
+
+    uint64_t off = 0;
+    for (int i = 0; i < cnt; ++i) {
+        FileEntry entry = {off, bft_len(&parts[i])};
+        fwrite(&entry, sizeof(entry), 1, file);
+        off += entry.len + 1;
+    }
+
+    for (int i = 0; i < cnt; ++i) {
+        const Buffet *part = &parts[i];
+        const Tag tag = TAG(part);
+        fwrite(getdata(part, tag), 1, getlen(part, tag), file);
+        fputc(0, file);
+    }
+
+    if (ferror(file) | fclose(file)) {
+        ERR("cannot write %s\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Map a file written by bft_save() and return its parts, 
+ * pointing straight into the mapping, without parsing or copying data.
+ * If `owner` is set, it receives the mapping and parts are VUE on it.
+ * Else parts are OWN co-owners, the last one freed unmaps the file.
+ *
+ * @param[in] path the source file path
+ * @param[out] outcnt the resulting list length
+ * @param[out] owner optional Buffet owning the mapping
+ * @return the resulting parts Buffet array, to be freed, or NULL on error
+*/
+Buffet*
+bft_load (const char *path, int *outcnt, Buffet *owner)
+{
+    Buffet map = bft_mapfile(path, BUFFET_MAP_WILLNEED);
+    const char *data = bft_data(&map);
+    const size_t len = bft_len(&map);
+    const FileHeader *head = (const FileHeader*)data;
+    const FileEntry *index = (const FileEntry*)(head+1);
+    const char *blob = NULL;
+    Buffet *parts = NULL;
+
+    *outcnt = 0;
+    if (owner) *owner = ZERO;
+
+    if (len < sizeof(*head)
+    || memcmp(head->magic, FILE_MAGIC, 4)
+    || head->version != FILE_VERSION
+    || head->cnt > INT_MAX
+    || (len - sizeof(*head)) / sizeof(*index) < head->cnt
+    || (blob = (const char*)(index + head->cnt), 
+        (size_t)(data + len - blob) != head->bloblen)) {
+        ERR("bad file %s\n", path);
+        goto fail;
+    }
+
+    const int cnt = head->cnt;
+    parts = malloc((cnt ? cnt : 1) * sizeof(Buffet));
+    if (!parts) {ERR_ALLOC; goto fail;}
+
+    for (int i = 0; i < cnt; ++i) {
+        const FileEntry *entry = &index[i];
+        if (entry->off > head->bloblen || entry->len >= head->bloblen - entry->off) {
+            ERR("bad file %s\n", path);
+            for (int j = 0; j < i; ++j) bft_free(&parts[j]);
+            goto fail;
+        }
+        size_t off = blob + entry->off - data;
+        parts[i] = owner ? new_vue(data + off, entry->len) 
+                         : bft_view(&map, off, entry->len);
+    }
+
+    if (owner) *owner = map;
+    else bft_free(&map);
+    
+    *outcnt = cnt;
+    return parts;
+
+    fail:
+    free(parts);
+    bft_free(&map);
+    return NULL;
+}
+
+
+//============================================================================
+// Rope
+//============================================================================
+
+typedef struct BuffetNode {
+    Buffet buf;
+    struct BuffetNode *next;
+} Node;
+
+static Node*
+new_node (Buffet buf, Node *next)
+{
+    Node *node = malloc(sizeof(Node));
+    if (!node) {ERR_ALLOC; return NULL;}
+    node->buf = buf;
+    node->next = next;
+    return node;
+}
+
+// Share a range of `chunk`. 
+// Small data is copied so that no SSV ever points into a node.
+static Buffet
+chunk_part (const Buffet *chunk, size_t off, size_t len)
+{
+    Tag tag = TAG(chunk);
+    if (tag==OWN || tag==VUE) return bft_view((Buffet*)chunk, off, len);
+    return bft_copy(chunk, off, len);
+}
+
+// Link chunk `buf` at byte offset `off`, splitting the chunk found there.
+// The rope takes ownership of `buf`.
+static size_t
+rope_link (BuffetRope *rope, size_t off, Buffet buf)
+{
+    const size_t len = bft_len(&buf);
+    Node *prev = NULL;
+    Node *node = rope->head;
+    size_t pos = 0;
+
+    if (!len) {bft_free(&buf); return rope->len;}
+
+    if (off >= rope->len) {
+        // fast append
+        prev = rope->tail;
+        node = NULL;
+    } else {
+        while (node) {
+            size_t nlen = bft_len(&node->buf);
+            if (off < pos+nlen) break;
+            pos += nlen;
+            prev = node;
+            node = node->next;
+        }
+
+        if (off > pos) {
+            size_t nlen = bft_len(&node->buf);
+            Node *right = new_node(chunk_part(&node->buf, off-pos, pos+nlen-off), 
+                node->next);
+            if (!right) {bft_free(&buf); return 0;}
+            Buffet left = chunk_part(&node->buf, 0, off-pos);
+            bft_free(&node->buf);
+            node->buf = left;
+            node->next = right;
+            if (rope->tail == node) rope->tail = right;
+            ++ rope->cnt;
+            prev = node;
+            node = right;
+        }
+    }
+
+    Node *fresh = new_node(buf, node);
+    if (!fresh) {bft_free(&buf); return 0;}
+
+    if (prev) prev->next = fresh; 
+    else rope->head = fresh;
+    if (!node) rope->tail = fresh;
+    rope->len += len;
+    ++ rope->cnt;
+
+    return rope->len;
+}
+
+/**
+ * Append a byte array to a rope.
+ * Fills the tail chunk in place if possible, else links a new chunk 
+ * of at least BUFFET_ROPE_CHUNK bytes. Existing data is never moved.
+ *
+ * @param[in,out] rope the destination rope
+ * @param[in] src the byte array source
+ * @param[in] len the source length
+ * @return the rope new length or zero on error
+*/
+size_t
+bft_rope_append (BuffetRope *rope, const char *src, size_t len)
+{
+    Node *tail = rope->tail;
+
+    if (!len) return rope->len;
+
+    if (tail && TAG(&tail->buf) == OWN) {
+        
+        Buffet *buf = &tail->buf;
+        Store *store = getstore(buf);
+        size_t end = buf->ptr.off + buf->ptr.len;
+        
+        // same conditions as append()
+        if (!(store->flags & STORE_MAPPED) 
+            && (store->refcnt < 2 || end == store->len)) {
+            
+            size_t room = store->cap - end;
+            size_t n = len < room ? len : room;
+            touch_store(store);
+            memcpy(store->data + end, src, n);
+            store->len = end + n;
+            store->data[store->len] = 0;
+            buf->ptr.len += n;
+            rope->len += n;
+            src += n;
+            len -= n;
+            if (!len) return rope->len;
+        }
+    }
+
+    size_t cap = len > BUFFET_ROPE_CHUNK ? len : BUFFET_ROPE_CHUNK;
+    Store *store = new_store(cap, len);
+    if (!store) return 0;
+    memcpy(store->data, src, len);
+    store->data[len] = 0;
+
+    Buffet chunk = {
+        .ptr.data = store->data,
+        .ptr.len = len,
+        .ptr.off = 0,
+        .ptr.tag = OWN
+    };
+
+    return rope_link(rope, rope->len, chunk);
+}
+
+/**
+ * Insert a copy of a byte array into a rope, as a new chunk.
+ * The chunk found at `off` is split into two views, without copy.
+ *
+ * @param[in,out] rope the destination rope
+ * @param[in] off the insertion offset, clipped to the rope length
+ * @param[in] src the byte array source
+ * @param[in] len the source length
+ * @return the rope new length or zero on error
+*/
+size_t
+bft_rope_insert (BuffetRope *rope, size_t off, const char *src, size_t len)
+{
+    if (off >= rope->len) return bft_rope_append(rope, src, len);
+    Buffet chunk = bft_memcopy(src, len);
+    if (bft_len(&chunk) != len) return 0;
+    return rope_link(rope, off, chunk);
+}
+
+/**
+ * Insert a Buffet into a rope.
+ * Owned and viewed data is shared without copy, only small data is copied.
+ *
+ * @param[in,out] rope the destination rope
+ * @param[in] off the insertion offset, clipped to the rope length
+ * @param[in] buf the Buffet to insert
+ * @return the rope new length or zero on error
+*/
+size_t
+bft_rope_splice (BuffetRope *rope, size_t off, const Buffet *buf)
+{
+    Tag tag = TAG(buf);
+    Buffet chunk = (tag==OWN || tag==VUE) ? bft_dup(buf) : bft_copyall(buf);
+    if (bft_len(&chunk) != getlen(buf, tag)) return 0;
+    return rope_link(rope, off, chunk);
+}
+
+/**
+ * Create a rope viewing a range of a rope, possibly across chunks.
+ *
+ * @param[in] rope the source rope
+ * @param[in] off offset to start from
+ * @param[in] len length in bytes, clipped to the rope length
+ * @return the new rope, to be freed, or an empty rope on error
+*/
+BuffetRope
+bft_rope_view (const BuffetRope *rope, size_t off, size_t len)
+{
+    BuffetRope ret = BUFFET_ROPE_ZERO;
+    size_t pos = 0;
+
+    for (Node *node = rope->head; node && len; node = node->next) {
+        
+        size_t nlen = bft_len(&node->buf);
+        
+        if (off < pos+nlen) {
+            size_t beg = off > pos ? off-pos : 0;
+            size_t n = nlen-beg < len ? nlen-beg : len;
+            Buffet part = chunk_part(&node->buf, beg, n);
+            const bool copied = bft_len(&part) == n;
+            if (!copied) bft_free(&part);
+            if (!copied || !rope_link(&ret, ret.len, part)) {
+                bft_rope_free(&ret);
+                return ret;
+            }
+            len -= n;
+        }
+        
+        pos += nlen;
+    }
+
+    return ret;
+}
+
+/**
+ * Get a rope as a contiguous Buffet.
+ * A multi-chunk rope is first collapsed into a single chunk.
+ *
+ * @param[in,out] rope the source rope
+ * @return a co-owning Buffet, to be freed
+*/
+Buffet
+bft_rope_flatten (BuffetRope *rope)
+{
+    if (!rope->cnt) return ZERO;
+
+    if (rope->cnt > 1) {
+        
+        const size_t len = rope->len;
+        Buffet flat = bft_new(len);
+        const Tag tag = TAG(&flat);
+        
+        if (tag==SSO && len > BUFFET_SSOMAX) return ZERO;
+
+        char *cur = getdata(&flat, tag);
+        for (Node *node = rope->head; node; node = node->next) {
+            const Buffet *buf = &node->buf;
+            const Tag ntag = TAG(buf);
+            size_t nlen = getlen(buf, ntag);
+            memcpy(cur, getdata(buf, ntag), nlen);
+            cur += nlen;
+        }
+        *cur = 0;
+        
+        if (tag==SSO) {
+            flat.sso.len = len;
+        } else {
+            flat.ptr.len = len;
+            getstore(&flat)->len = len;
+        }
+
+        bft_rope_free(rope);
+        rope_link(rope, 0, flat);
+    }
+
+    return bft_dup(&rope->head->buf);
+}
+
+/**
+ * Describe a rope's chunks as an iovec array, without copy.
+ *
+ * @param[in] rope the source rope
+ * @param[out] iov the iovec array to fill
+ * @param[in] max the iovec array capacity
+ * @return the number of iovec entries set
+*/
+int
+bft_rope_iovec (const BuffetRope *rope, struct iovec *iov, int max)
+{
+    int n = 0;
+    
+    for (Node *node = rope->head; node && n < max; node = node->next) 
+        bft_to_iovec(&node->buf, 1, &iov[n++]);
+    
+    return n;
+}
+
+/**
+ * Write a rope to a file descriptor with writev(), without flattening.
+ *
+ * @param[in] fd the destination file descriptor
+ * @param[in] rope the source rope
+ * @return bytes written, or -1 on error if nothing was written
+*/
+ssize_t
+bft_rope_writev (int fd, const BuffetRope *rope)
+{
+    struct iovec iov[IOV_BATCH];
+    size_t done = 0;
+    size_t skip = 0; // bytes of node already written
+    const Node *node = rope->head;
+
+    for (;;) {
+
+        // batch next non-empty chunks
+        int n = 0;
+        for (const Node *at = node; at && n < IOV_BATCH; at = at->next) {
+            const Tag tag = TAG(&at->buf);
+            size_t len = getlen(&at->buf, tag);
+            if (at==node) len -= skip;
+            if (!len) continue;
+            iov[n].iov_base = getdata(&at->buf, tag) + (at==node ? skip : 0);
+            iov[n].iov_len = len;
+            ++n;
+        }
+
+        if (!n) break;
+
+        ssize_t rc = writev(fd, iov, n);
+        
+        if (rc <= 0) {
+            if (rc && errno == EINTR) continue;
+            return done ? (ssize_t)done : -1;
+        }
+
+        done += rc;
+
+        // advance over written bytes
+        size_t w = rc;
+        while (node) {
+            size_t rem = bft_len(&node->buf) - skip;
+            if (w < rem) {skip += w; break;}
+            w -= rem;
+            skip = 0;
+            node = node->next;
+        }
+    }
+
+    return done;
+}
+
+/**
+ * Discard a rope, releasing its chunks.
+ *
+ * @param[in] rope the rope to discard
+*/
+void
+bft_rope_free (BuffetRope *rope)
+{
+    Node *node = rope->head;
+
+    while (node) {
+        Node *next = node->next;
+        bft_free(&node->buf);
+        free(node);
+        node = next;
+    }
+
+    *rope = BUFFET_ROPE_ZERO;
+}
+
+
+//============================================================================
+// Reader
+//============================================================================
+
+/**
+ * Create a reader handing out records of `fd` as views into its chunks.
+ *
+ * @param[in] fd the source file descriptor
+ * @param[in] chunksz the chunk capacity, or 0 for BUFFET_READER_CHUNK
+*/
+BuffetReader
+bft_reader (int fd, size_t chunksz)
+{
+    return (BuffetReader) {
+        .chunk = ZERO,
+        .chunksz = chunksz ? chunksz : BUFFET_READER_CHUNK,
+        .fd = fd,
+    };
+}
+
+// Read more data into the current chunk, or into a new chunk 
+// starting with the unfinished record.
+// Returns false on end of input, or on error with rd->err set.
+static bool
+reader_fill (BuffetReader *rd)
+{
+    Buffet *chunk = &rd->chunk;
+    Store *store = TAG(chunk)==OWN ? getstore(chunk) : NULL;
+
+    if (!store || store->len == store->cap) {
+
+        const size_t rest = store ? store->len - rd->pos : 0;
+        size_t cap = rd->chunksz;
+        if (cap < 2*rest) cap = 2*rest;
+
+        Store *fresh = new_store(cap, rest);
+        if (!fresh) {rd->err = ENOMEM; return false;}
+        
+        // stitch the straddling record
+        if (rest) memcpy(fresh->data, store->data + rd->pos, rest);
+        bft_free(chunk);
+
+        *chunk = (Buffet) {
+            .ptr.data = fresh->data,
+            .ptr.len = rest,
+            .ptr.off = 0,
+            .ptr.tag = OWN
+        };
+        rd->scan -= rd->pos;
+        rd->pos = 0;
+        store = fresh;
+    }
+
+    // Records only view bytes below store->len : we can write after.
+    for (;;) {
+        ssize_t got = read(rd->fd, store->data + store->len, 
+            store->cap - store->len);
+        
+        if (got > 0) {
+            touch_store(store);
+            store->len += got;
+            store->data[store->len] = 0;
+            chunk->ptr.len = store->len;
+            return true;
+        }
+        
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            rd->err = errno;
+            ERR("read error\n");
+        }
+        
+        return false;
+    }
+}
+
+/**
+ * Read the next record ending with a separator. 
+ * The record is an OWN view into the chunk : no copy except for records 
+ * straddling two chunks. A chunk is released with its last record.
+ * The last record needs no trailing separator.
+ * On a read or allocation error, `rd->err` is set and the unfinished 
+ * record is dropped : a truncated stream never ends like a clean one.
+ *
+ * @param[in,out] rd the reader
+ * @param[in] sep the separator
+ * @param[in] seplen the separator length in bytes
+ * @param[out] out the record, without separator, to be freed
+ * @return false on end of input, or on error with `rd->err` set
+*/
+bool
+bft_read_record (BuffetReader *rd, const char *sep, size_t seplen, Buffet *out)
+{
+    for (;;) {
+
+        if (TAG(&rd->chunk) == OWN) {
+
+            const char *data = rd->chunk.ptr.data;
+            const size_t len = rd->chunk.ptr.len;
+            const char *found = (seplen == 1) 
+                ? memchr(data + rd->scan, *sep, len - rd->scan)
+                : memmem(data + rd->scan, len - rd->scan, sep, seplen);
+
+            if (found) {
+                size_t end = found - data;
+                *out = bft_view(&rd->chunk, rd->pos, end - rd->pos);
+                rd->pos = rd->scan = end + seplen;
+                return true;
+            }
+
+            // resume search where a separator may begin
+            rd->scan = (len - rd->pos >= seplen) ? len - seplen + 1 : rd->pos;
+        }
+
+        if (rd->eof || !reader_fill(rd)) {
+            
+            rd->eof = true;
+
+            if (!rd->err && TAG(&rd->chunk) == OWN 
+                && rd->pos < rd->chunk.ptr.len) {
+                size_t len = rd->chunk.ptr.len;
+                *out = bft_view(&rd->chunk, rd->pos, len - rd->pos);
+                rd->pos = rd->scan = len;
+                return true;
+            }
+
+            *out = ZERO;
+            return false;
+        }
+    }
+}
+
+/**
+ * Read the next line. See bft_read_record().
+ *
+ * @param[in,out] rd the reader
+ * @param[out] line the line, without '\n', to be freed
+ * @return false on end of input, or on error with `rd->err` set
+*/
+bool
+bft_readline (BuffetReader *rd, Buffet *line) {
+    return bft_read_record(rd, "\n", 1, line);
+}
+
+/**
+ * Discard a reader. Records already read stay valid.
+ *
+ * @param[in] rd the reader
+*/
+void
+bft_reader_free (BuffetReader *rd)
+{
+    bft_free(&rd->chunk);
+    rd->pos = rd->scan = 0;
+    rd->eof = true;
+}
+
+
+//============================================================================
+// Parallel
+//============================================================================
+
+#define PAR_MAXTHREADS 64
+
+// Range of blocks owned by a worker, stolen from by idle ones.
+typedef struct {
+    atomic_size_t next;
+    size_t end;
+    char pad[64-sizeof(atomic_size_t)-sizeof(size_t)]; // no false sharing
+} ParQueue;
+
+typedef struct {
+    void (*run)(void *job, size_t beg, size_t end); // process parts [beg,end)
+    void *job;
+    size_t cnt;
+    size_t block;   // parts per block
+    int nqueues;
+    ParQueue queues[PAR_MAXTHREADS];
+} ParTask;
+
+// Lazily started pool. The calling thread works as worker 0.
+static struct {
+    pthread_once_t once;
+    pthread_mutex_t busy;   // one task at a time
+    pthread_mutex_t mtx;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    ParTask *task;
+    unsigned gen;           // task generation
+    int pending;            // workers still on task
+    int nthreads;
+} pool = {
+    .once = PTHREAD_ONCE_INIT,
+    .busy = PTHREAD_MUTEX_INITIALIZER,
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static _Thread_local bool in_pool = false;
+
+// Drain own queue, then steal from the others.
+static void
+par_work (ParTask *task, int self)
+{
+    const int nq = task->nqueues;
+
+    for (int i = 0; i < nq; ++i) {
+        ParQueue *q = &task->queues[(self+i) % nq];
+        size_t blk;
+        while ((blk = atomic_fetch_add(&q->next, 1)) < q->end) {
+            size_t beg = blk * task->block;
+            size_t end = beg + task->block;
+            if (end > task->cnt) end = task->cnt;
+            task->run(task->job, beg, end);
+        }
+    }
+}
+
+static void*
+par_worker (void *arg)
+{
+    const int self = (int)(intptr_t)arg;
+    unsigned seen = 0;
+
+    in_pool = true;
+
+    for (;;) {
+        pthread_mutex_lock(&pool.mtx);
+        while (pool.gen == seen) pthread_cond_wait(&pool.wake, &pool.mtx);
+        seen = pool.gen;
+        ParTask *task = pool.task;
+        pthread_mutex_unlock(&pool.mtx);
+
+        par_work(task, self);
+
+        pthread_mutex_lock(&pool.mtx);
+        if (!--pool.pending) pthread_cond_signal(&pool.done);
+        pthread_mutex_unlock(&pool.mtx);
+    }
+
+    return NULL;
+}
+
+// A forked child has none of the workers : start afresh on next use.
+static void
+par_atfork_child (void)
+{
+    pool.once = (pthread_once_t)PTHREAD_ONCE_INIT;
+    pthread_mutex_init(&pool.busy, NULL);
+    pthread_mutex_init(&pool.mtx, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    pool.task = NULL;
+    pool.gen = 0;
+    pool.pending = 0;
+    pool.nthreads = 0;
+}
+
+static void
+par_atfork (void) {
+    pthread_atfork(NULL, NULL, par_atfork_child);
+}
+
+// Thread count is ncpu-1, or env BUFFET_THREADS.
+static void
+par_init (void)
+{
+    static pthread_once_t atfork = PTHREAD_ONCE_INIT; // kept across fork
+    pthread_once(&atfork, par_atfork);
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    const char *env = getenv("BUFFET_THREADS");
+    if (env) n = atol(env);
+    if (n < 0) n = 0;
+    if (n > PAR_MAXTHREADS-1) n = PAR_MAXTHREADS-1;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (int i = 1; i <= n; ++i) {
+        pthread_t th;
+        if (pthread_create(&th, &attr, par_worker, (void*)(intptr_t)i)) {
+            ERR("pthread_create\n");
+            break;
+        }
+        ++ pool.nthreads;
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+// Run `run` over [0,cnt) in blocks of `block` parts, in order.
+static void
+par_run_seq (void (*run)(void*, size_t, size_t), void *job, size_t cnt, 
+    size_t block)
+{
+    for (size_t beg = 0; beg < cnt; beg += block) 
+        run(job, beg, cnt-beg < block ? cnt : beg+block);
+}
+
+// Run `run` over [0,cnt) in blocks of `block` parts.
+// Falls back to sequential if single block, no workers, or nested call.
+// Either way, each call covers a single block.
+static void
+par_run_by (void (*run)(void*, size_t, size_t), void *job, size_t cnt, 
+    size_t block)
+{
+    const size_t nblocks = (cnt + block-1) / block;
+
+    if (nblocks < 2 || in_pool) {
+        par_run_seq(run, job, cnt, block);
+        return;
+    }
+
+    pthread_once(&pool.once, par_init);
+
+    if (!pool.nthreads) {
+        par_run_seq(run, job, cnt, block);
+        return;
+    }
+
+    ParTask task = {.run = run, .job = job, .cnt = cnt, .block = block};
+    int nq = pool.nthreads + 1;
+    if ((size_t)nq > nblocks) nq = nblocks;
+    task.nqueues = nq;
+
+    for (int i = 0; i < nq; ++i) {
+        atomic_init(&task.queues[i].next, nblocks * i / nq);
+        task.queues[i].end = nblocks * (i+1) / nq;
+    }
+
+    pthread_mutex_lock(&pool.busy);
+    in_pool = true;
+
+    pthread_mutex_lock(&pool.mtx);
+    pool.task = &task;
+    pool.pending = pool.nthreads;
+    ++ pool.gen;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.mtx);
+
+    par_work(&task, 0);
+
+    pthread_mutex_lock(&pool.mtx);
+    while (pool.pending) pthread_cond_wait(&pool.done, &pool.mtx);
+    pthread_mutex_unlock(&pool.mtx);
+
+    in_pool = false;
+    pthread_mutex_unlock(&pool.busy);
+}
+
+static inline void
+par_run (void (*run)(void*, size_t, size_t), void *job, size_t cnt) {
+    par_run_by(run, job, cnt, BUFFET_PAR_BLOCK);
+}
+
+
+typedef struct {
+    Buffet *parts;
+    void (*fun)(Buffet*, void*);
+    void *arg;
+} ParFor;
+
+static void
+par_for_run (void *job, size_t beg, size_t end)
+{
+    ParFor *p = job;
+    for (size_t i = beg; i < end; ++i) p->fun(&p->parts[i], p->arg);
+}
+
+/**
+ * Apply a function to every Buffet of a list, in parallel.
+ * `fun` may mutate its part, but must not view, dup or free Buffets
+ * sharing a store with another part : refcounts are not atomic.
+ *
+ * @param[in,out] parts the Buffet array
+ * @param[in] cnt the array length
+ * @param[in] fun the function called on each part
+ * @param[in] arg user argument passed to `fun`
+*/
+void
+bft_par_for (Buffet *parts, int cnt, void (*fun)(Buffet*, void*), void *arg)
+{
+    if (cnt <= 0) return;
+    ParFor job = {parts, fun, arg};
+    par_run(par_for_run, &job, cnt);
+}
+
+
+typedef struct {
+    const Buffet *parts;
+    char *out;
+    size_t outsize;
+    void (*fun)(const Buffet*, void*, void*);
+    void *arg;
+} ParMap;
+
+static void
+par_map_run (void *job, size_t beg, size_t end)
+{
+    ParMap *p = job;
+    for (size_t i = beg; i < end; ++i) 
+        p->fun(&p->parts[i], p->out + i*p->outsize, p->arg);
+}
+
+/**
+ * Map every Buffet of a list to a result slot, in parallel.
+ * `fun` gets the i-th part and the address `out + i*outsize`.
+ * Same restriction as bft_par_for() : no view, dup or free of shared stores.
+ *
+ * @param[in] parts the Buffet array
+ * @param[in] cnt the array length
+ * @param[out] out the results array of `cnt` elements of `outsize` bytes
+ * @param[in] outsize the size of a result element
+ * @param[in] fun the mapping function
+ * @param[in] arg user argument passed to `fun`
+*/
+void
+bft_par_map (const Buffet *parts, int cnt, void *out, size_t outsize,
+    void (*fun)(const Buffet*, void*, void*), void *arg)
+{
+    if (cnt <= 0) return;
+    ParMap job = {parts, out, outsize, fun, arg};
+    par_run(par_map_run, &job, cnt);
+}
+
+
+typedef struct {
+    const Buffet *parts;
+    size_t cnt;
+    const char *sep;
+    size_t seplen;
+    size_t *blocklen;   // pass 1: block length, pass 2: block offset
+    char *data;
+} ParJoin;
+
+static void
+par_join_size (void *job, size_t beg, size_t end)
+{
+    ParJoin *p = job;
+    size_t len = 0;
+    for (size_t i = beg; i < end; ++i) {
+        const Buffet *part = &p->parts[i];
+        len += getlen(part, TAG(part));
+    }
+    p->blocklen[beg/BUFFET_PAR_BLOCK] = len;
+}
+
+static void
+par_join_copy (void *job, size_t beg, size_t end)
+{
+    ParJoin *p = job;
+    char *cur = p->data + p->blocklen[beg/BUFFET_PAR_BLOCK] + beg*p->seplen;
+
+    for (size_t i = beg; i < end; ++i) {
+        const Buffet *part = &p->parts[i];
+        const Tag tag = TAG(part);
+        size_t len = getlen(part, tag);
+        memcpy(cur, getdata(part, tag), len);
+        cur += len;
+        if (i < p->cnt-1) {
+            memcpy(cur, p->sep, p->seplen);
+            cur += p->seplen;
+        }
+    }
+}
+
+/**
+ * Join a list of Buffet along a separator into a new Buffet.
+ * Sizing and copy are done in parallel blocks.
+ *
+ * @param[in] parts the Buffet source array
+ * @param[in] cnt the source array length
+ * @param[in] sep the separator string
+ * @param[in] seplen the separator length in bytes
+ * @return the resulting Buffet
+*/
+Buffet
+bft_par_join (const Buffet *parts, int cnt, const char* sep, size_t seplen)
+{
+    if (cnt <= 0) return ZERO;
+
+    const size_t nblocks = (cnt + BUFFET_PAR_BLOCK-1) / BUFFET_PAR_BLOCK;
+    size_t *blocklen = malloc(nblocks * sizeof(*blocklen));
+    if (!blocklen) {ERR_ALLOC; return ZERO;}
+
+    ParJoin job = {parts, cnt, sep, seplen, blocklen, NULL};
+    par_run(par_join_size, &job, cnt);
+
+    // block lengths to offsets
+    size_t totlen = 0;
+    for (size_t b = 0; b < nblocks; ++b) {
+        size_t len = blocklen[b];
+        blocklen[b] = totlen;
+        totlen += len;
+    }
+    totlen += (cnt-1)*seplen;
+
+    Buffet ret = bft_new(totlen);
+    const Tag rettag = TAG(&ret);
+    
+    if (rettag==SSO && totlen > BUFFET_SSOMAX) {
+        free(blocklen);
+        return ZERO;
+    }
+
+    job.data = getdata(&ret, rettag);
+    par_run(par_join_copy, &job, cnt);
+    job.data[totlen] = 0;
+
+    if (rettag==SSO) ret.sso.len = totlen; 
+    else ret.ptr.len = totlen;
+
+    free(blocklen);
+
+    return ret;
+}
+
+
+//============================================================================
+// Batch loading
+//============================================================================
+
+#define LOAD_BLOCK 16       // files per pool block
+#define URING_WINDOW 256    // files in flight per ring round
+
+// Own a store filled with `len` bytes, or release it if empty.
+static Buffet
+own_store (Store *store, size_t len)
+{
+    if (!len) {
+        release_store(store);
+        return ZERO;
+    }
+
+    store->len = len;
+    store->data[len] = 0;
+
+    return (Buffet) {
+        .ptr.data = store->data,
+        .ptr.len = len,
+        .ptr.off = 0,
+        .ptr.tag = OWN
+    };
+}
+
+// open, fstat and pread a whole file.
+static Buffet
+load_file (const char *path)
+{
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return ZERO;
+
+    Buffet ret = ZERO;
+    struct stat st;
+
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size) {
+
+        const size_t size = st.st_size;
+        Store *store = new_store(size, 0);
+        size_t got = 0;
+
+        while (store && got < size) {
+            ssize_t rc = pread(fd, store->data+got, size-got, got);
+            if (rc < 0 && errno == EINTR) continue;
+            if (rc < 0) {release_store(store); store = NULL;}
+            if (rc <= 0) break; // shrunk
+            got += rc;
+        }
+
+        if (store) ret = own_store(store, got);
+    }
+
+    close(fd);
+    return ret;
+}
+
+typedef struct {
+    const char *const *paths;
+    Buffet *out;
+} LoadJob;
+
+static void
+load_run (void *job, size_t beg, size_t end)
+{
+    LoadJob *j = job;
+    for (size_t i = beg; i < end; ++i) j->out[i] = load_file(j->paths[i]);
+}
+
+#ifdef HAVE_URING
+
+// Bare io_uring, without liburing.
+typedef struct {
+    int fd;
+    unsigned queued;    // pushed, not yet submitted
+    unsigned *sqtail, *sqmask, *sqarray;
+    unsigned *cqhead, *cqtail, *cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqring, *cqring;
+    size_t sqlen, cqlen, sqeslen;
+} Uring;
+
+static void
+uring_free (Uring *r)
+{
+    if (r->sqes) munmap(r->sqes, r->sqeslen);
+    if (r->cqring) munmap(r->cqring, r->cqlen);
+    if (r->sqring) munmap(r->sqring, r->sqlen);
+    close(r->fd);
+}
+
+// Setup a ring, if the kernel allows and supports the loader's operations.
+static bool
+uring_init (Uring *r, unsigned entries)
+{
+    struct io_uring_params p = {0};
+    *r = (Uring){0};
+
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) return false;
+
+    struct {
+        struct io_uring_probe head;
+        struct io_uring_probe_op ops[IORING_OP_LAST];
+    } probe = {0};
+
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, 
+        &probe, IORING_OP_LAST) < 0) {
+        close(r->fd);
+        return false;
+    }
+
+    const int need[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, 
+        IORING_OP_CLOSE};
+    for (size_t i = 0; i < sizeof(need)/sizeof(*need); ++i) {
+        if (need[i] > probe.head.last_op 
+        || !(probe.ops[need[i]].flags & IO_URING_OP_SUPPORTED)) {
+            close(r->fd);
+            return false;
+        }
+    }
+
+    r->sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    const int prot = PROT_READ|PROT_WRITE;
+    const int flags = MAP_SHARED|MAP_POPULATE;
+    void *sq = mmap(NULL, r->sqlen, prot, flags, r->fd, IORING_OFF_SQ_RING);
+    void *cq = mmap(NULL, r->cqlen, prot, flags, r->fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, r->sqeslen, prot, flags, r->fd, IORING_OFF_SQES);
+    r->sqring = sq == MAP_FAILED ? NULL : sq;
+    r->cqring = cq == MAP_FAILED ? NULL : cq;
+    r->sqes = sqes == MAP_FAILED ? NULL : sqes;
+
+    if (!r->sqring || !r->cqring || !r->sqes) {
+        uring_free(r);
+        return false;
+    }
+
+    r->sqtail = (unsigned*)((char*)sq + p.sq_off.tail);
+    r->sqmask = (unsigned*)((char*)sq + p.sq_off.ring_mask);
+    r->sqarray = (unsigned*)((char*)sq + p.sq_off.array);
+    r->cqhead = (unsigned*)((char*)cq + p.cq_off.head);
+    r->cqtail = (unsigned*)((char*)cq + p.cq_off.tail);
+    r->cqmask = (unsigned*)((char*)cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)((char*)cq + p.cq_off.cqes);
+
+    return true;
+}
+
+// Queue an entry. The caller keeps in flight no more than the ring size.
+static void
+uring_push (Uring *r, const struct io_uring_sqe *sqe)
+{
+    const unsigned tail = *r->sqtail;
+    const unsigned idx = tail & *r->sqmask;
+
+    r->sqes[idx] = *sqe;
+    r->sqarray[idx] = idx;
+    atomic_store_explicit((_Atomic unsigned*)r->sqtail, tail+1, 
+        memory_order_release);
+    ++ r->queued;
+}
+
+// Submit queued entries, then hand each completion to `done`, which may 
+// push follow-ups, until nothing is in flight.
+// If submitting fails, entries still queued are dropped and the ones 
+// already submitted are waited for : on return, the kernel is done 
+// with every buffer. Returns false if entries were dropped.
+static bool
+uring_drain (Uring *r, void (*done)(void*, Uring*, uint64_t, int), void *job)
+{
+    unsigned inflight = r->queued;
+    bool ok = true;
+
+    while (inflight) {
+
+        // after a failed submit, unqueue what the kernel has not seen
+        if (!ok && r->queued) {
+            atomic_store_explicit((_Atomic unsigned*)r->sqtail, 
+                *r->sqtail - r->queued, memory_order_release);
+            inflight -= r->queued;
+            r->queued = 0;
+            if (!inflight) break;
+        }
+
+        int rc = syscall(__NR_io_uring_enter, r->fd, r->queued, 1, 
+            IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EBUSY && errno != EAGAIN) {
+                if (r->queued) {
+                    ERR("io_uring_enter\n");
+                    ok = false;
+                    continue;
+                }
+                sched_yield(); // cannot wait : poll the completions
+            }
+            // reap completions, then retry
+        } else {
+            r->queued -= rc;
+        }
+
+        unsigned head = *r->cqhead;
+        while (head != atomic_load_explicit((_Atomic unsigned*)r->cqtail, 
+            memory_order_acquire)) {
+
+            const struct io_uring_cqe *cqe = &r->cqes[head & *r->cqmask];
+            const uint64_t data = cqe->user_data;
+            const int res = cqe->res;
+            atomic_store_explicit((_Atomic unsigned*)r->cqhead, ++head, 
+                memory_order_release);
+
+            const unsigned queued = r->queued;
+            done(job, r, data, res);
+            inflight += r->queued - queued;
+            -- inflight;
+        }
+    }
+
+    return ok;
+}
+
+// A window of files through the ring : 
+// open+statx round, read round (short reads resumed), close round.
+typedef struct {
+    const char *const *paths;
+    Buffet *out;
+    int fds[URING_WINDOW];
+    struct statx stx[URING_WINDOW];
+    Store *stores[URING_WINDOW];
+    size_t got[URING_WINDOW];
+} Uload;
+
+enum {UOP_OPEN, UOP_STATX, UOP_READ, UOP_CLOSE};
+
+#define UDATA(i,op) ((uint64_t)(i) << 2 | (op))
+
+static void
+uload_read (Uring *r, Uload *u, int i)
+{
+    const Store *store = u->stores[i];
+    const size_t got = u->got[i];
+    const size_t rest = store->cap - got;
+
+    uring_push(r, &(struct io_uring_sqe){
+        .opcode = IORING_OP_READ,
+        .fd = u->fds[i],
+        .addr = (uintptr_t)(store->data + got),
+        .len = rest < (1u<<30) ? rest : (1u<<30),
+        .off = got,
+        .user_data = UDATA(i, UOP_READ)
+    });
+}
+
+static void
+uload_done (void *job, Uring *r, uint64_t data, int res)
+{
+    Uload *u = job;
+    const int i = data >> 2;
+
+    switch (data & 3) {
+
+        case UOP_OPEN: 
+            u->fds[i] = res;
+            break;
+
+        case UOP_STATX: 
+            if (res < 0) u->stx[i].stx_size = 0;
+            break;
+
+        case UOP_READ: {
+            if (res < 0 && res != -EINTR && res != -EAGAIN) {
+                release_store(u->stores[i]);
+                u->stores[i] = NULL;
+                break;
+            }
+            if (!res) { // shrunk
+                u->stores[i]->cap = u->got[i];
+                break;
+            }
+            if (res > 0) u->got[i] += res;
+            if (u->got[i] < u->stores[i]->cap) uload_read(r, u, i);
+            break;
+        }
+
+        case UOP_CLOSE: 
+            if (res < 0) close(u->fds[i]);
+            u->fds[i] = -1;
+            break;
+    }
+}
+
+// Load paths [beg,end), at most URING_WINDOW.
+static bool
+uload_window (Uring *r, Uload *u, int beg, int end)
+{
+    const int n = end-beg;
+
+    for (int i = 0; i < n; ++i) {
+        u->fds[i] = -1;
+        u->stores[i] = NULL;
+        u->got[i] = 0;
+        u->stx[i].stx_mode = 0;
+        u->stx[i].stx_size = 0;
+        uring_push(r, &(struct io_uring_sqe){
+            .opcode = IORING_OP_OPENAT,
+            .fd = AT_FDCWD,
+            .addr = (uintptr_t)u->paths[beg+i],
+            .open_flags = O_RDONLY|O_CLOEXEC,
+            .user_data = UDATA(i, UOP_OPEN)
+        });
+        uring_push(r, &(struct io_uring_sqe){
+            .opcode = IORING_OP_STATX,
+            .fd = AT_FDCWD,
+            .addr = (uintptr_t)u->paths[beg+i],
+            .len = STATX_TYPE|STATX_SIZE,
+            .off = (uintptr_t)&u->stx[i],
+            .user_data = UDATA(i, UOP_STATX)
+        });
+    }
+
+    bool ok = uring_drain(r, uload_done, u);
+
+    if (ok) {
+        for (int i = 0; i < n; ++i) {
+            const size_t size = u->stx[i].stx_size;
+            if (u->fds[i] < 0 || !S_ISREG(u->stx[i].stx_mode) || !size) 
+                continue;
+            u->stores[i] = new_store(size, 0);
+            if (u->stores[i]) uload_read(r, u, i);
+        }
+        ok = uring_drain(r, uload_done, u);
+    }
+
+    // nothing in flight anymore : stores and fds are ours
+    for (int i = 0; i < n; ++i) {
+        Store *store = u->stores[i];
+        if (store && ok) u->out[beg+i] = own_store(store, u->got[i]);
+        else if (store) release_store(store);
+        if (ok && u->fds[i] >= 0) {
+            uring_push(r, &(struct io_uring_sqe){
+                .opcode = IORING_OP_CLOSE,
+                .fd = u->fds[i],
+                .user_data = UDATA(i, UOP_CLOSE)
+            });
+        }
+    }
+
+    if (ok) uring_drain(r, uload_done, u);
+
+    // closes not done by the ring
+    for (int i = 0; i < n; ++i) if (u->fds[i] >= 0) close(u->fds[i]);
+
+    return ok;
+}
+
+// Load all paths through a ring. False if no ring could be used.
+static bool
+uring_load (const char *const *paths, int cnt, Buffet *out)
+{
+    const char *env = getenv("BUFFET_URING");
+    if (env && !atoi(env)) return false;
+
+    Uring ring;
+    if (!uring_init(&ring, 2*URING_WINDOW)) return false;
+
+    Uload *u = malloc(sizeof(Uload));
+    if (!u) {ERR_ALLOC; uring_free(&ring); return false;}
+    u->paths = paths;
+    u->out = out;
+
+    bool ok = true;
+    for (int beg = 0; ok && beg < cnt; beg += URING_WINDOW) {
+        int end = beg + URING_WINDOW < cnt ? beg + URING_WINDOW : cnt;
+        ok = uload_window(&ring, u, beg, end);
+    }
+
+    free(u);
+    uring_free(&ring);
+    
+    return ok;
+}
+
+#endif
+
+/**
+ * Load many whole files at once, each into a new OWN Buffet.
+ * Reads are batched through io_uring when available (unless env 
+ * BUFFET_URING=0), else spread over the parallel pool with pread().
+ * Unreadable, empty or non-regular files give an empty Buffet.
+ *
+ * @param[in] paths the file paths
+ * @param[in] cnt number of paths
+ * @return new array of `cnt` Buffets to free, or NULL on allocation failure
+*/
+Buffet*
+bft_load_files (const char *const *paths, int cnt)
+{
+    Buffet *out = calloc(cnt > 0 ? cnt : 1, sizeof(Buffet));
+    if (!out) {ERR_ALLOC; return NULL;}
+    if (cnt <= 0) return out;
+
+    #ifdef HAVE_URING
+    if (uring_load(paths, cnt, out)) return out;
+    #endif
+
+    // no ring, or ring failure : start over on the pool
+    LoadJob job = {paths, out};
+    for (int i = 0; i < cnt; ++i) bft_free(&out[i]);
+    par_run_by(load_run, &job, cnt, LOAD_BLOCK);
+
+    return out;
+}
+
+
+/**
+ * Compare two buffets' data using memcmp.
+ * 
+ * @param[in] a the first Buffet
+ * @param[in] b the second Buffet
+ * @return same logic as memcmp : 0 if equal, signed bytes diff otherwise
+ */
+int
+bft_cmp (const Buffet *a, const Buffet *b)
+{
+    if (a==b) return 0;
+
+    Tag taga = TAG(a);
+    Tag tagb = TAG(b);
+    size_t lena = getlen(a, taga);
+    size_t lenb = getlen(b, tagb);
+    const char *dataa = getdata(a, taga);
+    const char *datab = getdata(b, tagb);
+
+    size_t minlen = lena < lenb ? lena : lenb;
+    int cmp = dataa==datab ? 0 : memcmp(dataa, datab, minlen);
+    if (cmp) return cmp;
+
+    // sign of length difference, which may not fit an int
+    return (lena > lenb) - (lena < lenb);
+}
+
+/**
+ * Test two buffets' data for equality, faster than bft_cmp() :
+ * lengths first, then wide compares with early exit.
+ * 
+ * @param[in] a the first Buffet
+ * @param[in] b the second Buffet
+ * @return true if same length and bytes
+ */
+bool
+bft_eq (const Buffet *a, const Buffet *b)
+{
+    if (a==b) return true;
+
+    Tag taga = TAG(a);
+    Tag tagb = TAG(b);
+    size_t len = getlen(a, taga);
+    if (len != getlen(b, tagb)) return false;
+
+    if (taga==SSO && tagb==SSO) return eq_sso(&a->sso, &b->sso, len);
+
+    const char *dataa = getdata(a, taga);
+    const char *datab = getdata(b, tagb);
+
+    return dataa==datab || eq_bytes(dataa, datab, len);
+}
+
+
+//============================================================================
+// Case & trim
+//============================================================================
+
+// Data of `buf` if writable in place : SSO without views, 
+// or sole owner of a store not mapped. Else NULL.
+static char*
+inplace (Buffet *buf)
+{
+    switch (TAG(buf)) {
+
+        case SSO:
+            return buf->sso.rfc ? NULL : buf->sso.data;
+
+        case OWN: {
+            Store *store = getstore(buf);
+            #if MEMCHECK
+                if (store->canary != CANARY) {WARN_CANARY; return NULL;}
+            #endif
+            if (store->refcnt < 2 && !(store->flags & STORE_MAPPED)) {
+                touch_store(store);
+                return buf->ptr.data;
+            }
+            return NULL;
+        }
+
+        default:
+            return NULL;
+    }
+}
+
+// Make `buf` data writable : in place if possible, else by relocating 
+// to a copy. Returns the data, or NULL on error or insecure mutation.
+static char*
+writable (Buffet *buf)
+{
+    char *data = inplace(buf);
+    if (data) return data;
+
+    const Tag tag = TAG(buf);
+    const size_t len = getlen(buf, tag);
+
+    if (tag==SSO) {
+        WARN("Mutation would alter views on SSO\n");
+        return NULL;
+    }
+
+    LOG("writable: copy");
+    Buffet copy = bft_memcopy(getdata(buf, tag), len);
+    if (len > BUFFET_SSOMAX && TAG(&copy) != OWN) return NULL;
+    bft_free(buf);
+    *buf = copy;
+
+    return getdata(buf, TAG(buf));
+}
+
+// Make `out` a new Buffet of length `len`, SSO if it fits. 
+// Returns its data to fill, or NULL on allocation failure.
+static char*
+sized (Buffet *out, size_t len)
+{
+    if (len <= BUFFET_SSOMAX) {
+        *out = ZERO;
+        out->sso.len = len;
+        return out->sso.data;
+    }
+
+    Store *store = new_store(len, len);
+    if (!store) return NULL;
+    *out = (Buffet) {
+        .ptr.data = store->data,
+        .ptr.len = len,
+        .ptr.off = 0,
+        .ptr.tag = OWN
+    };
+    return store->data;
+}
+
+// Cut `buf`, written in place by a transform, to `len`.
+static void
+shrink (Buffet *buf, size_t len)
+{
+    if (TAG(buf)==SSO) {
+        buf->sso.len = len;
+        buf->sso.data[len] = 0;
+    } else {
+        buf->ptr.len = len;
+        getstore(buf)->len = buf->ptr.off + len;
+        buf->ptr.data[len] = 0;
+    }
+}
+
+/**
+ * Convert ASCII letters to lowercase, other bytes untouched.
+ * In place if `buf` is an SSO or the sole owner of its store, 
+ * else `buf` is relocated to a converted copy, leaving co-owners intact.
+ * 
+ * @param[in,out] buf the Buffet
+ * @return false on allocation failure, or if `buf` is an SSO with views
+ */
+bool
+bft_lower (Buffet *buf)
+{
+    char *data = writable(buf);
+    if (!data) return false;
+    case_bytes(data, getlen(buf, TAG(buf)), 'A');
+    return true;
+}
+
+/**
+ * Convert ASCII letters to uppercase, like bft_lower().
+ * 
+ * @param[in,out] buf the Buffet
+ * @return false on allocation failure, or if `buf` is an SSO with views
+ */
+bool
+bft_upper (Buffet *buf)
+{
+    char *data = writable(buf);
+    if (!data) return false;
+    case_bytes(data, getlen(buf, TAG(buf)), 'a');
+    return true;
+}
+
+/**
+ * Compare two buffets' data ignoring ASCII case, like bft_cmp().
+ * 
+ * @param[in] a the first Buffet
+ * @param[in] b the second Buffet
+ * @return 0 if equal, else diff of the first differing bytes once lowered
+ */
+int
+bft_casecmp (const Buffet *a, const Buffet *b)
+{
+    Tag taga = TAG(a);
+    Tag tagb = TAG(b);
+    size_t lena = getlen(a, taga);
+    size_t lenb = getlen(b, tagb);
+    const char *dataa = getdata(a, taga);
+    const char *datab = getdata(b, tagb);
+
+    size_t minlen = lena < lenb ? lena : lenb;
+    int cmp = dataa==datab ? 0 : casecmp_bytes(dataa, datab, minlen);
+    if (cmp) return cmp;
+
+    return (lena > lenb) - (lena < lenb);
+}
+
+/**
+ * Get a view on a Buffet's data without leading and trailing whitespace.
+ * No copy : like bft_view(), the result is a view co-owning `buf`.
+ * Whitespace is found 64 bytes at a time with SSE2/AVX2 masks.
+ * 
+ * @param[in] buf the source Buffet
+ * @return the trimmed view, ZERO if all whitespace
+ */
+Buffet
+bft_trim (Buffet *buf)
+{
+    const Tag tag = TAG(buf);
+    const char *data = getdata(buf, tag);
+    const size_t len = getlen(buf, tag);
+    const size_t beg = space_span(data, len, true);
+    const size_t end = beg < len ? space_rtrim(data, len) : len;
+
+    return bft_view(buf, beg, end-beg);
+}
+
+/**
+ * Get a view without leading whitespace, like bft_trim().
+ * 
+ * @param[in] buf the source Buffet
+ * @return the trimmed view, ZERO if all whitespace
+ */
+Buffet
+bft_ltrim (Buffet *buf)
+{
+    const Tag tag = TAG(buf);
+    const size_t len = getlen(buf, tag);
+    const size_t beg = space_span(getdata(buf, tag), len, true);
+
+    return bft_view(buf, beg, len-beg);
+}
+
+/**
+ * Get a view without trailing whitespace, like bft_trim().
+ * 
+ * @param[in] buf the source Buffet
+ * @return the trimmed view, ZERO if all whitespace
+ */
+Buffet
+bft_rtrim (Buffet *buf)
+{
+    const Tag tag = TAG(buf);
+    return bft_view(buf, 0, space_rtrim(getdata(buf, tag), getlen(buf, tag)));
+}
+
+/**
+ * Start a lazy split of `src` on runs of whitespace. 
+ * `src` must outlive the tokenizer, and not change while in use.
+ * 
+ * @param[in] src the source Buffet
+ * @return the tokenizer
+ */
+BuffetTokenizer
+bft_tokenizer (Buffet *src)
+{
+    return (BuffetTokenizer){.src = src, .pos = 0, .blk = SIZE_MAX};
+}
+
+// Token bytes of the 64-byte block at `blk`, cached in `tk`.
+static inline uint64_t
+token_mask (BuffetTokenizer *tk, const char *data, size_t len, size_t blk)
+{
+    if (tk->blk != blk) {
+        tk->tok = ~space_mask(data+blk, len-blk);
+        tk->blk = blk;
+    }
+    return tk->tok;
+}
+
+/**
+ * Get the next whitespace-separated token, as a view co-owning the source 
+ * like bft_view().
+ * 
+ * @param[in,out] tk the tokenizer
+ * @param[out] tok the token, to free
+ * @return false when no token is left
+ */
+bool
+bft_next_token (BuffetTokenizer *tk, Buffet *tok)
+{
+    const Tag tag = TAG(tk->src);
+    const char *data = getdata(tk->src, tag);
+    const size_t len = getlen(tk->src, tag);
+    size_t pos = tk->pos, blk, beg, end;
+
+    // first token byte from pos
+    for (;; pos = blk+64) {
+        if (pos >= len) {tk->pos = len; return false;}
+        blk = pos & ~(size_t)63;
+        const uint64_t m = token_mask(tk, data, len, blk) >> (pos-blk) << (pos-blk);
+        if (m) {beg = blk + __builtin_ctzll(m); break;}
+    }
+
+    // first space after : padding makes one at len
+    for (pos = beg;; pos = blk += 64) {
+        const uint64_t m = ~token_mask(tk, data, len, blk) >> (pos-blk) << (pos-blk);
+        if (m) {end = blk + __builtin_ctzll(m); break;}
+        if (blk+64 >= len) {end = len; break;}
+    }
+    
+    *tok = bft_view(tk->src, beg, end-beg);
+    tk->pos = end;
+    return true;
+}
+
+// Count tokens if `out` is NULL, else write them as views.
+// Token edges are the changes in 64-bit whitespace masks.
+static int
+tokens (Buffet *src, const char *data, size_t len, Buffet *out)
+{
+    int cnt = 0;
+    uint64_t carry = 0; // previous byte is a token byte
+    size_t beg = 0;
+
+    for (size_t i = 0; i < len; i += 64) {
+        const uint64_t tok = ~space_mask(data+i, len-i);
+        const uint64_t prev = tok << 1 | carry;
+        carry = tok >> 63;
+
+        if (!out) {
+            cnt += __builtin_popcountll(tok & ~prev);
+            continue;
+        }
+
+        // starts and ends alternate; padding ends the last token at `len`
+        for (uint64_t edges = tok ^ prev; edges; edges &= edges-1) {
+            const int bit = __builtin_ctzll(edges);
+            if (tok >> bit & 1) beg = i + bit;
+            else out[cnt++] = bft_view(src, beg, i + bit - beg);
+        }
+    }
+
+    if (out && carry) out[cnt++] = bft_view(src, beg, len-beg);
+    return cnt;
+}
+
+/**
+ * Split a Buffet on runs of whitespace, without empty tokens. 
+ * Tokens are views co-owning `src` like bft_view(), in an array sized 
+ * by a first counting pass.
+ * 
+ * @param[in] src the source Buffet
+ * @param[out] outcnt the number of tokens
+ * @return the tokens array, to free after the tokens. NULL if none.
+ */
+Buffet*
+bft_tokenize_ws (Buffet *src, int *outcnt)
+{
+    const Tag tag = TAG(src);
+    const char *data = getdata(src, tag);
+    const size_t len = getlen(src, tag);
+
+    *outcnt = 0;
+    const int cnt = tokens(src, data, len, NULL);
+    if (!cnt) return NULL;
+
+    Buffet *ret = malloc(cnt * sizeof(Buffet));
+    if (!ret) {ERR_ALLOC; return NULL;}
+    *outcnt = tokens(src, data, len, ret);
+
+    return ret;
+}
+
+
+//============================================================================
+// UTF-8
+//============================================================================
+
+// Scalar validation, by the well-formed sequences of Unicode table 3-7.
+static bool
+utf8_valid_scalar (const unsigned char *p, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len) {
+        const unsigned c = p[i];
+        if (c < 0x80) {++i; continue;}
+
+        size_t n;
+        unsigned lo = 0x80, hi = 0xBF; // range of the 2nd byte
+        if (c >= 0xC2 && c <= 0xDF) n = 2;
+        else if (c >= 0xE0 && c <= 0xEF) {
+            n = 3;
+            if (c == 0xE0) lo = 0xA0; // overlong
+            if (c == 0xED) hi = 0x9F; // surrogate
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            n = 4;
+            if (c == 0xF0) lo = 0x90; // overlong
+            if (c == 0xF4) hi = 0x8F; // over U+10FFFF
+        } else return false;
+
+        if (len-i < n) return false;
+        if (p[i+1] < lo || p[i+1] > hi) return false;
+        for (size_t k = 2; k < n; ++k) 
+            if ((p[i+k] & 0xC0) != 0x80) return false;
+        i += n;
+    }
+
+    return true;
+}
+
+#ifdef SIMD_X86
+
+// Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte".
+// Each byte pair is classified by three nibble lookups whose AND is 
+// non-zero on an error, then 3rd and 4th continuations are checked 
+// against leads 2 and 3 bytes back.
+
+enum {
+    U8_TOO_SHORT  = 1<<0, // 11______ 0_______
+    U8_TOO_LONG   = 1<<1, // 0_______ 10______
+    U8_OVERLONG_3 = 1<<2, // 11100000 100_____
+    U8_TOO_LARGE  = 1<<3, // 11110100 1001____
+    U8_SURROGATE  = 1<<4, // 11101101 101_____
+    U8_OVERLONG_2 = 1<<5, // 1100000_ 10______
+    U8_TOO_LARGE_1000 = 1<<6, // 11110101 1000____
+    U8_OVERLONG_4 = 1<<6, // 11110000 1000____
+    U8_TWO_CONTS  = 1<<7, // 10______ 10______
+    U8_CARRY = U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS,
+    U8_LARGE = U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CONT = U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS,
+};
+
+#define SET16(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+// `cur` shifted by `n` bytes, the first ones taken from `prev`
+#define PREV(cur, prev, n) _mm256_alignr_epi8(cur, \
+    _mm256_permute2x128_si256(prev, cur, 0x21), 16-(n))
+
+__attribute__((target("avx2")))
+static inline __m256i
+utf8_special (__m256i cur, __m256i prev1)
+{
+    const __m256i nib = _mm256_set1_epi8(0x0F);
+    
+    const __m256i hi1 = _mm256_shuffle_epi8(SET16(
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+        U8_TOO_SHORT | U8_OVERLONG_2,
+        U8_TOO_SHORT,
+        U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+        U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4),
+        _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib));
+
+    const __m256i lo1 = _mm256_shuffle_epi8(SET16(
+        U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+        U8_CARRY | U8_OVERLONG_2,
+        U8_CARRY, U8_CARRY,
+        U8_CARRY | U8_TOO_LARGE,
+        U8_LARGE, U8_LARGE, U8_LARGE,
+        U8_LARGE, U8_LARGE, U8_LARGE, U8_LARGE, U8_LARGE,
+        U8_LARGE | U8_SURROGATE,
+        U8_LARGE, U8_LARGE),
+        _mm256_and_si256(prev1, nib));
+
+    const __m256i hi2 = _mm256_shuffle_epi8(SET16(
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        U8_CONT | U8_OVERLONG_3 | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+        U8_CONT | U8_OVERLONG_3 | U8_TOO_LARGE,
+        U8_CONT | U8_SURROGATE | U8_TOO_LARGE,
+        U8_CONT | U8_SURROGATE | U8_TOO_LARGE,
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT),
+        _mm256_and_si256(_mm256_srli_epi16(cur, 4), nib));
+
+    return _mm256_and_si256(_mm256_and_si256(hi1, lo1), hi2);
+}
+
+// Error bits of block `cur` following block `prev`
+__attribute__((target("avx2")))
+static inline __m256i
+utf8_block (__m256i cur, __m256i prev)
+{
+    const __m256i sc = utf8_special(cur, PREV(cur, prev, 1));
+    const __m256i third = _mm256_subs_epu8(PREV(cur, prev, 2), 
+        _mm256_set1_epi8(0xE0-0x80));
+    const __m256i fourth = _mm256_subs_epu8(PREV(cur, prev, 3), 
+        _mm256_set1_epi8(0xF0-0x80));
+    const __m256i must23 = _mm256_and_si256(
+        _mm256_or_si256(third, fourth), _mm256_set1_epi8(0x80));
+    return _mm256_xor_si256(must23, sc);
+}
+
+// Non-zero if a lead in the last 3 bytes misses continuations
+__attribute__((target("avx2")))
+static inline __m256i
+utf8_incomplete (__m256i cur)
+{
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 
+        0xF0-1, 0xE0-1, 0xC0-1);
+    return _mm256_subs_epu8(cur, max);
+}
+
+__attribute__((target("avx2")))
+static bool
+utf8_valid_avx2 (const char *p, size_t len)
+{
+    __m256i prev = _mm256_setzero_si256();
+    __m256i err = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (;; i += 32) {
+        __m256i cur;
+        if (i+32 <= len) {
+            cur = _mm256_loadu_si256((const __m256i*)(p+i));
+        } else if (i < len) {
+            // zero-padded tail : a truncated sequence meets ASCII
+            char tail[32] = {0};
+            memcpy(tail, p+i, len-i);
+            cur = _mm256_loadu_si256((const __m256i*)tail);
+        } else break;
+
+        if (_mm256_movemask_epi8(cur)) {
+            err = _mm256_or_si256(err, utf8_block(cur, prev));
+            incomplete = utf8_incomplete(cur);
+        } else {
+            // ASCII block : only a sequence cut by it can fail
+            err = _mm256_or_si256(err, incomplete);
+            incomplete = _mm256_setzero_si256();
+        }
+        prev = cur;
+    }
+
+    err = _mm256_or_si256(err, incomplete);
+    return _mm256_testz_si256(err, err);
+}
+
+#undef SET16
+#undef PREV
+
+#endif
+
+// Whether `len` bytes are valid UTF-8. Leading ASCII skipped 8 by 8.
+static bool
+utf8_valid (const char *p, size_t len)
+{
+    size_t i = 0;
+    for (uint64_t w; i+8 <= len; i += 8) {
+        memcpy(&w, p+i, 8);
+        if (w & 0x8080808080808080ull) break;
+    }
+    p += i;
+    len -= i;
+
+    #ifdef SIMD_X86
+    if (len >= 32 && HAS_AVX2) return utf8_valid_avx2(p, len);
+    #endif
+    return utf8_valid_scalar((const unsigned char*)p, len);
+}
+
+// Lead bytes : all but continuations 10xxxxxx
+static inline bool
+utf8_lead (char c) {
+    return (signed char)c > -65;
+}
+
+#ifdef SIMD_X86
+
+// Lead bytes of the 32 at `p`, as a bitmask
+__attribute__((target("avx2,popcnt")))
+static inline uint32_t
+utf8_leads_avx2 (const char *p) {
+    return _mm256_movemask_epi8(_mm256_cmpgt_epi8(
+        _mm256_loadu_si256((const __m256i*)p), _mm256_set1_epi8(-65)));
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t
+utf8_count_avx2 (const char *p, size_t len, size_t *done)
+{
+    size_t cnt = 0, i = 0;
+    for (; i+32 <= len; i += 32) cnt += __builtin_popcount(utf8_leads_avx2(p+i));
+    *done = i;
+    return cnt;
+}
+
+// Offset of the `n`th lead (from 0) in blocks of 32, or of the block 
+// where to finish, `n` decremented by the leads skipped.
+__attribute__((target("avx2,popcnt")))
+static size_t
+utf8_skip_avx2 (const char *p, size_t len, size_t *n)
+{
+    size_t i = 0;
+    for (; i+32 <= len; i += 32) {
+        uint32_t m = utf8_leads_avx2(p+i);
+        const size_t cnt = __builtin_popcount(m);
+        if (cnt > *n) {
+            for (size_t k = *n; k; --k) m &= m-1;
+            *n = 0;
+            return i + __builtin_ctz(m);
+        }
+        *n -= cnt;
+    }
+    return i;
+}
+
+#endif
+
+// Code points in `len` bytes of valid UTF-8, as lead bytes.
+static size_t
+utf8_count (const char *p, size_t len)
+{
+    size_t cnt = 0, i = 0;
+
+    #ifdef SIMD_X86
+    if (HAS_AVX2) cnt = utf8_count_avx2(p, len, &i);
+    #endif
+
+    for (; i < len; ++i) cnt += utf8_lead(p[i]);
+    return cnt;
+}
+
+// Offset of code point `n` in `len` bytes, `len` if none.
+static size_t
+utf8_skip (const char *p, size_t len, size_t n)
+{
+    size_t i = 0;
+
+    #ifdef SIMD_X86
+    if (HAS_AVX2) i = utf8_skip_avx2(p, len, &n);
+    #endif
+
+    for (; i < len; ++i) 
+        if (utf8_lead(p[i]) && !n--) return i;
+    return len;
+}
+
+/**
+ * Check that a Buffet's data is valid UTF-8 : 
+ * shortest forms, no surrogates, nothing past U+10FFFF.
+ * A valid OWN Buffet spanning its whole store marks the store, 
+ * so that checks on it and its co-owners are free until the next write.
+ * 
+ * @param[in] buf the Buffet
+ * @return true if valid
+ */
+bool
+bft_utf8_valid (const Buffet *buf)
+{
+    const Tag tag = TAG(buf);
+    const char *data = getdata(buf, tag);
+    const size_t len = getlen(buf, tag);
+
+    if (tag==OWN && !buf->ptr.off) {
+        Store *store = getstore(buf);
+        if (len == store->len) {
+            if (store_cached(store, STORE_UTF8)) return true;
+            if (!utf8_valid(data, len)) return false;
+            store_cache(store, STORE_UTF8);
+            return true;
+        }
+    }
+
+    return utf8_valid(data, len);
+}
+
+/**
+ * Count the code points in a Buffet's UTF-8 data.
+ * Counts lead bytes : on invalid data, an approximation.
+ * 
+ * @param[in] buf the Buffet
+ * @return the number of code points
+ */
+size_t
+bft_utf8_len (const Buffet *buf)
+{
+    const Tag tag = TAG(buf);
+    return utf8_count(getdata(buf, tag), getlen(buf, tag));
+}
+
+/**
+ * Get a view on a range of code points of a Buffet's UTF-8 data, 
+ * like bft_view() with offsets in code points. 
+ * The range is clipped to the data.
+ * 
+ * @param[in] buf the source Buffet
+ * @param[in] off the first code point
+ * @param[in] cnt the number of code points
+ * @return the view, ZERO if empty
+ */
+Buffet
+bft_utf8_view (Buffet *buf, size_t off, size_t cnt)
+{
+    const Tag tag = TAG(buf);
+    const char *data = getdata(buf, tag);
+    const size_t len = getlen(buf, tag);
+
+    const size_t beg = utf8_skip(data, len, off);
+    const size_t end = beg + utf8_skip(data+beg, len-beg, cnt);
+
+    return bft_view(buf, beg, end-beg);
+}
+
+
+//============================================================================
+// Replace
+//============================================================================
+
+typedef struct {
+    const char *needle;
+    const char *repl;
+    size_t nlen;
+    size_t rlen;
+    size_t next; // offset of the next match
+} Pattern;
+
+// Leftmost match at or after `pos`, the first pattern on ties.
+// Returns the pattern index and sets `at`, or -1 if none.
+static int
+next_match (const char *data, size_t len, size_t pos, 
+    Pattern *pats, int cnt, size_t *at)
+{
+    int best = -1;
+    *at = len;
+
+    for (int k = 0; k < cnt; ++k) {
+        Pattern *pat = &pats[k];
+        if (!pat->nlen) continue;
+        if (pat->next < pos) 
+            pat->next = pos + find_bytes(data+pos, len-pos, pat->needle, pat->nlen);
+        if (pat->next < *at) {
+            *at = pat->next;
+            best = k;
+        }
+    }
+
+    return best;
+}
+
+// First match of each pattern
+static void
+rewind_patterns (const char *data, size_t len, Pattern *pats, int cnt) 
+{
+    for (int k = 0; k < cnt; ++k) {
+        Pattern *pat = &pats[k];
+        pat->next = pat->nlen ? find_bytes(data, len, pat->needle, pat->nlen) : len;
+    }
+}
+
+// Replace all matches : a counting pass sizes the output, then a writing 
+// pass fills it, in place if nothing grows and `buf` is writable in place.
+// Returns the number of replacements.
+static size_t
+replace_all (Buffet *buf, Pattern *pats, int cnt)
+{
+    const Tag tag = TAG(buf);
+    const char *data = getdata(buf, tag);
+    const size_t len = getlen(buf, tag);
+
+    if (tag==SSO && buf->sso.rfc) {
+        WARN("Mutation would alter views on SSO\n");
+        return 0;
+    }
+
+    size_t found = 0, outlen = len, at;
+    bool grows = false;
+    int k;
+
+    rewind_patterns(data, len, pats, cnt);
+    for (size_t pos = 0; 
+        (k = next_match(data, len, pos, pats, cnt, &at)) >= 0;
+        pos = at + pats[k].nlen) {
+        outlen = outlen - pats[k].nlen + pats[k].rlen;
+        grows |= pats[k].rlen > pats[k].nlen;
+        ++found;
+    }
+    if (!found) return 0;
+
+    Buffet out = ZERO;
+    char *dst = grows ? NULL : inplace(buf);
+    if (!dst && !(dst = sized(&out, outlen))) return 0;
+
+    // writing behind the reading position, never ahead of the search
+    size_t w = 0, pos = 0;
+    rewind_patterns(data, len, pats, cnt);
+    while ((k = next_match(data, len, pos, pats, cnt, &at)) >= 0) {
+        memmove(dst+w, data+pos, at-pos);
+        w += at-pos;
+        memcpy(dst+w, pats[k].repl, pats[k].rlen);
+        w += pats[k].rlen;
+        pos = at + pats[k].nlen;
+    }
+    memmove(dst+w, data+pos, len-pos);
+    dst[outlen] = 0;
+
+    if (dst == data) {
+        shrink(buf, outlen);
+    } else {
+        bft_free(buf);
+        *buf = out;
+    }
+
+    return found;
+}
+
+/**
+ * Replace all occurrences of a byte pattern in a Buffet, left to right.
+ * The output is sized by a first pass, then written in a single 
+ * allocation, or in place if `buf` is an SSO or the sole owner 
+ * of its store and `repl` is not longer than `needle`.
+ * 
+ * @param[in,out] buf the Buffet
+ * @param[in] needle the pattern
+ * @param[in] nlen the pattern length, 0 for no-op
+ * @param[in] repl the replacement
+ * @param[in] rlen the replacement length
+ * @return the number of replacements, 0 on allocation failure
+ */
+size_t
+bft_replace (Buffet *buf, const char *needle, size_t nlen, 
+    const char *repl, size_t rlen)
+{
+    Pattern pat = {needle, repl, nlen, rlen, 0};
+    return replace_all(buf, &pat, 1);
+}
+
+/**
+ * Replace all occurrences of several patterns in a Buffet, in one pass 
+ * like bft_replace(). At each position the leftmost match wins, 
+ * the first in `table` on ties. Replacements are not searched again.
+ * 
+ * @param[in,out] buf the Buffet
+ * @param[in] table `cnt` pairs of Buffets : pattern, replacement
+ * @param[in] cnt the number of pairs
+ * @return the number of replacements, 0 on allocation failure
+ */
+size_t
+bft_replace_many (Buffet *buf, const Buffet *table, int cnt)
+{
+    if (cnt <= 0) return 0;
+
+    Pattern pats_local[BUFFET_STACK_MEM/sizeof(Pattern)];
+    Pattern *pats = pats_local;
+    if ((size_t)cnt > sizeof(pats_local)/sizeof(Pattern)) {
+        pats = malloc(cnt * sizeof(Pattern));
+        if (!pats) {ERR_ALLOC; return 0;}
+    }
+
+    for (int k = 0; k < cnt; ++k) {
+        const Buffet *needle = &table[2*k];
+        const Buffet *repl = &table[2*k+1];
+        const Tag ntag = TAG(needle);
+        const Tag rtag = TAG(repl);
+        pats[k] = (Pattern) {
+            getdata(needle, ntag), getdata(repl, rtag), 
+            getlen(needle, ntag), getlen(repl, rtag), 0};
+    }
+
+    const size_t ret = replace_all(buf, pats, cnt);
+
+    if (pats != pats_local) free(pats);
+    return ret;
+}
+
+
+//============================================================================
+// Numbers
+//============================================================================
+
+// Formatting straight into reserved room : the exact length is known 
+// first, so that an SSO is not relocated for nothing.
+
+static const char DIGIT_PAIRS[] = 
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+static const uint64_t POW10[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 
+    10000000ull, 100000000ull, 1000000000ull, 10000000000ull, 
+    100000000000ull, 1000000000000ull, 10000000000000ull, 
+    100000000000000ull, 1000000000000000ull, 10000000000000000ull, 
+    100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull};
+
+static inline int
+count_digits (uint64_t v) {
+    const int t = ((64 - __builtin_clzll(v|1)) * 1233) >> 12; // ~log10
+    return t + (v >= POW10[t]) + !v;
+}
+
+// Decimal digits of `v`, ending at `end`, two at a time.
+static inline void
+write_digits (char *end, uint64_t v)
+{
+    while (v >= 100) {
+        end -= 2;
+        memcpy(end, DIGIT_PAIRS + 2*(v % 100), 2);
+        v /= 100;
+    }
+    if (v >= 10) memcpy(end-2, DIGIT_PAIRS + 2*v, 2);
+    else end[-1] = '0' + v;
+}
+
+static inline int
+hex_digits (uint64_t v) {
+    return (64 - __builtin_clzll(v|1) + 3) / 4;
+}
+
+static inline void
+write_hex (char *w, int len, uint64_t v) {
+    for (int i = len-1; i >= 0; --i, v >>= 4) w[i] = "0123456789abcdef"[v & 15];
+}
+
+// Schubfach : shortest decimal f*10^e rounding back to c*2^q. 
+// After R. Giulietti, "The Schubfach way to render doubles".
+
+#define SF_CMIN (1ull << 52)
+#define SF_QMIN (-1074)
+#define SF_MASK63 ((1ull << 63) - 1)
+
+static inline uint64_t
+mulhi64 (uint64_t a, uint64_t b) {
+    return ((__uint128_t)a * b) >> 64;
+}
+
+static inline int 
+flog10pow2 (int e) {
+    return (int)(((int64_t)e * 661971961083ll) >> 41);
+}
+
+static inline int 
+flog10_3q_pow2 (int e) { // floor(log10(3/4 * 2^e))
+    return (int)(((int64_t)e * 661971961083ll - 274743187321ll) >> 41);
+}
+
+static inline int 
+flog2pow10 (int e) {
+    return (int)(((int64_t)e * 913124641741ll) >> 38);
+}
+
+// Round to odd of g*cp
+static inline uint64_t
+sf_rop (uint64_t g1, uint64_t g0, uint64_t cp)
+{
+    const uint64_t x1 = mulhi64(g0, cp);
+    const uint64_t y0 = g1 * cp;
+    const uint64_t y1 = mulhi64(g1, cp);
+    const uint64_t z = (y0 >> 1) + x1;
+    const uint64_t vbp = y1 + (z >> 63);
+    return vbp | (((z & SF_MASK63) + SF_MASK63) >> 63);
+}
+
+static void
+schubfach (int q, uint64_t c, uint64_t *f, int *e)
+{
+    const uint64_t out = c & 1;
+    const uint64_t cb = c << 2;
+    const uint64_t cbr = cb + 2;
+    uint64_t cbl;
+    int k;
+
+    if (c != SF_CMIN || q == SF_QMIN) {
+        cbl = cb - 2;
+        k = flog10pow2(q);
+    } else {
+        cbl = cb - 1;
+        k = flog10_3q_pow2(q);
+    }
+
+    const int h = q + flog2pow10(-k) + 2;
+    const uint64_t g1 = POW10_G[k - POW10_KMIN][0];
+    const uint64_t g0 = POW10_G[k - POW10_KMIN][1];
+    const uint64_t vb = sf_rop(g1, g0, cb << h);
+    const uint64_t vbl = sf_rop(g1, g0, cbl << h);
+    const uint64_t vbr = sf_rop(g1, g0, cbr << h);
+    const uint64_t s = vb >> 2;
+
+    if (s >= 10) { // one digit less
+        const uint64_t sp10 = 10 * mulhi64(s, 115292150460684698ull << 4);
+        const uint64_t tp10 = sp10 + 10;
+        const bool upin = vbl + out <= sp10 << 2;
+        const bool wpin = (tp10 << 2) + out <= vbr;
+        if (upin != wpin) {
+            *f = upin ? sp10 : tp10;
+            *e = k;
+            return;
+        }
+    }
+
+    const uint64_t t = s + 1;
+    const bool uin = vbl + out <= s << 2;
+    const bool win = (t << 2) + out <= vbr;
+    *e = k;
+    if (uin != win) {
+        *f = uin ? s : t;
+        return;
+    }
+
+    const int64_t cmp = (int64_t)(vb - ((s + t) << 1));
+    *f = cmp < 0 || (cmp == 0 && !(s & 1)) ? s : t;
+}
+
+// Shortest decimal of finite `v` > 0, without trailing zeros.
+static void
+double_decimal (double v, uint64_t *f, int *e)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    const uint64_t t = bits & (SF_CMIN - 1);
+    const int bq = (bits >> 52) & 0x7ff;
+
+    if (bq) {
+        const int mq = -SF_QMIN + 1 - bq;
+        const uint64_t c = SF_CMIN | t;
+        if (0 < mq && mq < 53 && !(c & ((1ull << mq) - 1))) {
+            *f = c >> mq; // integer
+            *e = 0;
+        } else {
+            schubfach(-mq, c, f, e);
+        }
+    } else if (t < 3) {
+        // the two smallest : out of the algorithm's precision
+        *f = t == 1 ? 5 : 1;
+        *e = t == 1 ? -324 : -323;
+    } else {
+        schubfach(SF_QMIN, t, f, e);
+    }
+
+    while (*f >= 10 && *f % 10 == 0) {*f /= 10; ++*e;}
+}
+
+#undef SF_CMIN
+#undef SF_QMIN
+#undef SF_MASK63
+
+// Room for `len` bytes, then commit() once written.
+#define APPEND_NUM(buf, len, w) \
+    char *w = reserve(buf, len); \
+    if (!w) return 0;
+
+#define APPEND_DONE(buf, len) \
+    commit(buf, len); \
+    return getlen(buf, TAG(buf));
+
+/**
+ * Append an unsigned integer in decimal, without temporary buffer.
+ * 
+ * @param[in,out] buf the Buffet
+ * @param[in] val the integer
+ * @return new length, or zero on allocation failure
+ */
+size_t
+bft_append_u64 (Buffet *buf, uint64_t val)
+{
+    const int len = count_digits(val);
+    APPEND_NUM(buf, len, w);
+    write_digits(w + len, val);
+    APPEND_DONE(buf, len);
+}
+
+/**
+ * Append a signed integer in decimal, like bft_append_u64().
+ * 
+ * @param[in,out] buf the Buffet
+ * @param[in] val the integer
+ * @return new length, or zero on allocation failure
+ */
+size_t
+bft_append_i64 (Buffet *buf, int64_t val)
+{
+    const bool neg = val < 0;
+    const uint64_t mag = neg ? 0 - (uint64_t)val : (uint64_t)val;
+    const int len = neg + count_digits(mag);
+    APPEND_NUM(buf, len, w);
+    *w = '-';
+    write_digits(w + len, mag);
+    APPEND_DONE(buf, len);
+}
+
+/**
+ * Append an unsigned integer in lowercase hexadecimal, no prefix.
+ * 
+ * @param[in,out] buf the Buffet
+ * @param[in] val the integer
+ * @return new length, or zero on allocation failure
+ */
+size_t
+bft_append_hex (Buffet *buf, uint64_t val)
+{
+    const int len = hex_digits(val);
+    APPEND_NUM(buf, len, w);
+    write_hex(w, len, val);
+    APPEND_DONE(buf, len);
+}
+
+/**
+ * Append a double as the shortest decimal that reads back to it, 
+ * laid out like JavaScript : `0.1`, `1e+21`, `1.5e-7`, `-0`, 
+ * plus `nan` and `inf`. Locale-free, without temporary buffer.
+ * 
+ * @param[in,out] buf the Buffet
+ * @param[in] val the number
+ * @return new length, or zero on allocation failure
+ */
+size_t
+bft_append_double (Buffet *buf, double val)
+{
+    const bool neg = signbit(val);
+    const double mag = neg ? -val : val;
+
+    if (isnan(val)) return bft_append(buf, "nan", 3);
+    if (isinf(val)) return neg ? bft_append(buf, "-inf", 4) 
+                                   : bft_append(buf, "inf", 3);
+
+    uint64_t f = 0;
+    int e = 0;
+    if (mag != 0) double_decimal(mag, &f, &e);
+
+    const int n = count_digits(f);
+    const int dp = n + e; // decimal point position in digits
+    const int ex = dp - 1; // scientific exponent
+    int len;
+    enum {INT, FRAC, SMALL, SCI} form;
+
+    if (e >= 0 && dp <= 21) {
+        form = INT;     // ddd000
+        len = dp;
+    } else if (0 < dp && dp <= 21) {
+        form = FRAC;    // dd.ddd
+        len = n + 1;
+    } else if (-6 < dp && dp <= 0) {
+        form = SMALL;   // 0.000ddd
+        len = 2 - dp + n;
+    } else {
+        form = SCI;     // d.ddde+dd
+        len = n + (n > 1) + 2 + count_digits(ex < 0 ? -ex : ex);
+    }
+    len += neg;
+
+    APPEND_NUM(buf, len, w);
+    if (neg) *w++ = '-';
+
+    switch (form) {
+        case INT:
+            write_digits(w + n, f);
+            memset(w + n, '0', e);
+            break;
+        case FRAC:
+            write_digits(w + n + 1, f);
+            memmove(w, w+1, dp);
+            w[dp] = '.';
+            break;
+        case SMALL:
+            memset(w, '0', 2 - dp);
+            w[1] = '.';
+            write_digits(w + 2 - dp + n, f);
+            break;
+        case SCI: {
+            write_digits(w + 1 + n, f);
+            w[0] = w[1];
+            if (n > 1) w[1] = '.';
+            char *x = w + n + (n > 1);
+            *x++ = 'e';
+            *x++ = ex < 0 ? '-' : '+';
+            write_digits(x + count_digits(ex < 0 ? -ex : ex), ex < 0 ? -ex : ex);
+            break;
+        }
+    }
+
+    APPEND_DONE(buf, len);
+}
+
+#undef APPEND_NUM
+#undef APPEND_DONE
+
+// Parsing : bounded by the Buffet length, so views parse in place.
+
+static inline bool
+is_digit (char c) {
+    return (unsigned char)(c - '0') < 10;
+}
+
+static inline uint64_t
+load8 (const char *p) 
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+    #endif
+    return v;
+}
+
+// Whether the 8 bytes of `v` are all digits
+static inline bool
+swar_8digits (uint64_t v) {
+    return !(((v + 0x4646464646464646ull) | (v - 0x3030303030303030ull)) 
+        & 0x8080808080808080ull);
+}
+
+// Value of 8 digits, first one in the low byte
+static inline uint32_t
+swar_parse8 (uint64_t v)
+{
+    const uint64_t mask = 0x000000FF000000FFull;
+    const uint64_t mul1 = 0x000F424000000064ull; // 100 + (1000000 << 32)
+    const uint64_t mul2 = 0x0000271000000001ull; // 1 + (10000 << 32)
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8); // digit pairs
+    return (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+}
+
+// Digits from `p` into `val`, 8 at a time while possible.
+// Returns the first non-digit. Sets `ovf` past UINT64_MAX.
+static const char*
+parse_digits (const char *p, const char *end, uint64_t *val, bool *ovf)
+{
+    uint64_t v = *val;
+    bool o = false;
+
+    for (uint64_t w; end-p >= 8 && swar_8digits(w = load8(p)); p += 8) {
+        o |= __builtin_mul_overflow(v, 100000000, &v);
+        o |= __builtin_add_overflow(v, swar_parse8(w), &v);
+    }
+    for (; p < end && is_digit(*p); ++p) {
+        o |= __builtin_mul_overflow(v, 10, &v);
+        o |= __builtin_add_overflow(v, *p - '0', &v);
+    }
+
+    *val = v;
+    *ovf |= o;
+    return p;
+}
+
+// Optional sign, then digits up to `end` and a magnitude within `max`.
+static bool
+parse_int (const Buffet *buf, uint64_t max, bool allowneg, 
+    bool *neg, uint64_t *mag)
+{
+    const Tag tag = TAG(buf);
+    const char *p = getdata(buf, tag);
+    const char *end = p + getlen(buf, tag);
+
+    *neg = false;
+    if (p < end && (*p == '+' || (allowneg && *p == '-'))) *neg = *p++ == '-';
+    if (p == end || !is_digit(*p)) return false;
+
+    bool ovf = false;
+    *mag = 0;
+    p = parse_digits(p, end, mag, &ovf);
+
+    return p == end && !ovf && *mag <= max + *neg;
+}
+
+/**
+ * Parse a Buffet's data as a decimal unsigned integer : 
+ * optional `+`, digits, nothing else. No NUL terminator needed.
+ * 
+ * @param[in] buf the Buffet
+ * @param[out] out the value, untouched on failure
+ * @return false if not a number or out of range
+ */
+bool
+bft_to_u64 (const Buffet *buf, uint64_t *out)
+{
+    bool neg;
+    uint64_t mag;
+    if (!parse_int(buf, UINT64_MAX, false, &neg, &mag)) return false;
+    *out = mag;
+    return true;
+}
+
+/**
+ * Parse a Buffet's data as a decimal signed integer, like bft_to_u64()
+ * with an optional `-`.
+ * 
+ * @param[in] buf the Buffet
+ * @param[out] out the value, untouched on failure
+ * @return false if not a number or out of range
+ */
+bool
+bft_to_i64 (const Buffet *buf, int64_t *out)
+{
+    bool neg;
+    uint64_t mag;
+    if (!parse_int(buf, INT64_MAX, true, &neg, &mag)) return false;
+    *out = neg ? (int64_t)(0 - mag) : (int64_t)mag;
+    return true;
+}
+
+// Eisel-Lemire : nearest double to w*10^q, w < 2^64, 
+// by the truncated 128-bit product of w and 5^q.
+// Returns the biased exponent and sets the mantissa, -1 if undecided.
+
+#define EL_MANT 52
+#define EL_INF 0x7FF
+
+static int
+eisel_lemire (int64_t q, uint64_t w, uint64_t *mant)
+{
+    *mant = 0;
+    if (!w || q < POW5_QMIN) return 0;
+    if (q > POW5_QMAX) return EL_INF;
+
+    const int lz = __builtin_clzll(w);
+    w <<= lz;
+
+    // product, refined when the bits below the mantissa are all ones
+    const uint64_t *pow5 = POW5_128[q - POW5_QMIN];
+    __uint128_t prod = (__uint128_t)w * pow5[0];
+    uint64_t hi = prod >> 64, lo = prod;
+    const uint64_t precision = ~0ull >> (EL_MANT + 3);
+    if ((hi & precision) == precision) {
+        const uint64_t hi2 = ((__uint128_t)w * pow5[1]) >> 64;
+        lo += hi2;
+        hi += hi2 > lo;
+    }
+    if (lo == ~0ull && (q < -27 || q > 55)) return -1;
+
+    const int upper = hi >> 63;
+    const int shift = upper + 64 - EL_MANT - 3;
+    uint64_t m = hi >> shift;
+    int e2 = (int)((((152170 + 65536) * q) >> 16) + 63) + upper - lz + 1023;
+
+    if (e2 <= 0) { // subnormal
+        if (-e2 + 1 >= 64) return 0;
+        m >>= -e2 + 1;
+        m += m & 1;
+        m >>= 1;
+        *mant = m & ((1ull << EL_MANT) - 1);
+        return m < (1ull << EL_MANT) ? 0 : 1;
+    }
+
+    // exactly halfway : round to even
+    if (lo <= 1 && q >= -4 && q <= 23 && (m & 3) == 1 && (m << shift) == hi) 
+        m &= ~1ull;
+
+    m += m & 1;
+    m >>= 1;
+    if (m >= (2ull << EL_MANT)) {
+        m = 1ull << EL_MANT;
+        ++e2;
+    }
+    if (e2 >= EL_INF) return EL_INF;
+
+    *mant = m & ((1ull << EL_MANT) - 1);
+    return e2;
+}
+
+#undef EL_MANT
+#undef EL_INF
+
+// Exactly representable powers of ten
+static const double POW10_EXACT[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Fallback to libc, on a terminated copy
+static bool
+strtod_bounded (const char *p, size_t len, double *out)
+{
+    char local[128];
+    char *s = len < sizeof(local) ? local : malloc(len+1);
+    if (!s) {ERR_ALLOC; return false;}
+    memcpy(s, p, len);
+    s[len] = 0;
+    char *end;
+    *out = strtod(s, &end);
+    const bool ok = end == s + len;
+    if (s != local) free(s);
+    return ok;
+}
+
+static bool
+parse_double (const char *p, size_t len, double *out)
+{
+    const char *const beg = p;
+    const char *const end = p + len;
+    bool neg = false;
+
+    if (p < end && (*p == '+' || *p == '-')) neg = *p++ == '-';
+
+    // inf, infinity, nan
+    const size_t rest = end - p;
+    if ((rest == 3 || rest == 8) && !is_digit(*p) && *p != '.') {
+        double v;
+        if (!casecmp_bytes(p, "infinity", rest)) v = 1.0/0.0;
+        else if (rest == 3 && !casecmp_bytes(p, "nan", 3)) v = NAN;
+        else return false;
+        *out = neg ? -v : v;
+        return true;
+    }
+
+    // mantissa w, exponent q
+    uint64_t w = 0;
+    bool ovf = false;
+    const char *digits = p;
+    p = parse_digits(p, end, &w, &ovf);
+    int64_t ndigits = p - digits;
+    int64_t q = 0;
+    bool esat = false;
+
+    if (p < end && *p == '.') {
+        const char *frac = ++p;
+        p = parse_digits(p, end, &w, &ovf);
+        q = frac - p;
+        ndigits += p - frac;
+    }
+    if (!ndigits) return false;
+
+    if (p < end && (*p | 0x20) == 'e') {
+        ++p;
+        bool eneg = false;
+        if (p < end && (*p == '+' || *p == '-')) eneg = *p++ == '-';
+        if (p == end || !is_digit(*p)) return false;
+        int64_t e = 0;
+        for (; p < end && is_digit(*p); ++p) {
+            if (e >= 0x10000) esat = true; // may be offset by a long fraction
+            else e = 10*e + (*p - '0');
+        }
+        q += eneg ? -e : e;
+    }
+    if (p != end) return false;
+    if (esat) return strtod_bounded(beg, len, out);
+
+    // more than 19 significant digits : w is not exact
+    if (ndigits > 19) {
+        int64_t sig = ndigits;
+        for (const char *d = digits; d < end && (*d == '0' || *d == '.'); ++d) 
+            sig -= *d == '0';
+        if (sig > 19 || ovf) return strtod_bounded(beg, len, out);
+    }
+
+    double v;
+    #if FLT_EVAL_METHOD == 0
+    if (q >= -22 && q <= 22 && w <= (1ull << 53)) {
+        // Clinger : both operands exact, one rounding
+        v = (double)w;
+        v = q < 0 ? v / POW10_EXACT[-q] : v * POW10_EXACT[q];
+        *out = neg ? -v : v;
+        return true;
+    }
+    #endif
+
+    uint64_t mant;
+    const int e2 = eisel_lemire(q, w, &mant);
+    if (e2 < 0) return strtod_bounded(beg, len, out);
+
+    const uint64_t bits = mant | (uint64_t)e2 << 52 | (uint64_t)neg << 63;
+    memcpy(&v, &bits, sizeof(v));
+    *out = v;
+    return true;
+}
+
+/**
+ * Parse a Buffet's data as a decimal floating-point number, as strtod() 
+ * in the C locale : optional sign, digits with an optional `.` and 
+ * exponent, or `inf`, `infinity`, `nan`. No hexadecimal forms.
+ * Correctly rounded, by the Clinger fast path or the Eisel-Lemire 
+ * algorithm. Only inputs of more than 19 significant digits go to strtod().
+ * 
+ * @param[in] buf the Buffet
+ * @param[out] out the value, untouched on failure
+ * @return false if the whole data is not a number
+ */
+bool
+bft_to_double (const Buffet *buf, double *out)
+{
+    const Tag tag = TAG(buf);
+    return parse_double(getdata(buf, tag), getlen(buf, tag), out);
+}
+
+typedef struct {
+    const Buffet *parts;
+    void *out;
+    atomic_int valid;
+} ParseJob;
+
+static void
+to_double_run (void *job, size_t beg, size_t end)
+{
+    ParseJob *j = job;
+    double *out = j->out;
+    int valid = 0;
+
+    for (size_t i = beg; i < end; ++i) {
+        if (bft_to_double(&j->parts[i], &out[i])) ++valid;
+        else out[i] = NAN;
+    }
+    atomic_fetch_add(&j->valid, valid);
+}
+
+static void
+to_i64_run (void *job, size_t beg, size_t end)
+{
+    ParseJob *j = job;
+    int64_t *out = j->out;
+    int valid = 0;
+
+    for (size_t i = beg; i < end; ++i) {
+        if (bft_to_i64(&j->parts[i], &out[i])) ++valid;
+        else out[i] = 0;
+    }
+    atomic_fetch_add(&j->valid, valid);
+}
+
+/**
+ * Parse a list of Buffets as doubles, like bft_to_double() on each, 
+ * spread over the parallel pool. Meant for bft_split() fields.
+ * 
+ * @param[in] parts the Buffet array
+ * @param[in] cnt the array length
+ * @param[out] out the `cnt` values, NAN where invalid
+ * @return the number of valid parts
+ */
+int
+bft_to_double_many (const Buffet *parts, int cnt, double *out)
+{
+    if (cnt <= 0) return 0;
+    ParseJob job = {parts, out, 0};
+    par_run(to_double_run, &job, cnt);
+    return job.valid;
+}
+
+/**
+ * Parse a list of Buffets as signed integers, like bft_to_i64() on each, 
+ * spread over the parallel pool.
+ * 
+ * @param[in] parts the Buffet array
+ * @param[in] cnt the array length
+ * @param[out] out the `cnt` values, 0 where invalid
+ * @return the number of valid parts
+ */
+int
+bft_to_i64_many (const Buffet *parts, int cnt, int64_t *out)
+{
+    if (cnt <= 0) return 0;
+    ParseJob job = {parts, out, 0};
+    par_run(to_i64_run, &job, cnt);
+    return job.valid;
+}
+
+
+//============================================================================
+// Formatting
+//============================================================================
+
+// Bytes writable after `buf` data without relocation, as reserve() sees it.
+static size_t
+spare (const Buffet *buf)
+{
+    switch (TAG(buf)) {
+
+        case SSO:
+            return BUFFET_SSOMAX - buf->sso.len;
+
+        case OWN: {
+            const Store *store = getstore(buf);
+            const size_t end = buf->ptr.off + buf->ptr.len;
+            if ((store->flags & STORE_MAPPED) 
+                || (store->refcnt > 1 && end != store->len)) return 0;
+            return store->cap - end;
+        }
+
+        case SSV: {
+            const BuffetSSO *target = 
+                (const BuffetSSO*)(buf->ptr.data - buf->ptr.off);
+            const size_t end = buf->ptr.off + buf->ptr.len;
+            if (target->rfc > 1 && end != target->len) return 0;
+            return BUFFET_SSOMAX - end;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+// One conversion's argument, fetched by type
+typedef union {
+    intmax_t i;
+    uintmax_t u;
+    double d;
+    long double ld;
+    const void *p;
+} FmtArg;
+
+typedef enum {ARG_INT, ARG_LONG, ARG_LLONG, ARG_INTMAX, ARG_SIZE, ARG_PTRDIFF, 
+    ARG_DOUBLE, ARG_LDOUBLE, ARG_PTR} ArgType;
+
+static int
+format1 (char *dst, size_t size, const char *spec, ArgType type, const FmtArg *arg)
+{
+    switch (type) {
+        case ARG_INT:     return snprintf(dst, size, spec, (int)arg->i);
+        case ARG_LONG:    return snprintf(dst, size, spec, (long)arg->i);
+        case ARG_LLONG:   return snprintf(dst, size, spec, (long long)arg->i);
+        case ARG_INTMAX:  return snprintf(dst, size, spec, arg->i);
+        case ARG_SIZE:    return snprintf(dst, size, spec, (size_t)arg->u);
+        case ARG_PTRDIFF: return snprintf(dst, size, spec, (ptrdiff_t)arg->i);
+        case ARG_DOUBLE:  return snprintf(dst, size, spec, arg->d);
+        case ARG_LDOUBLE: return snprintf(dst, size, spec, arg->ld);
+        case ARG_PTR:     return snprintf(dst, size, spec, arg->p);
+    }
+    return -1;
+}
+
+// Write cursor over a Buffet's spare room, committed on close.
+typedef struct {
+    Buffet *buf;
+    char *w;     // spare room
+    size_t room;
+    size_t n;    // bytes written
+    size_t done; // bytes committed
+} FmtOut;
+
+static void
+out_open (FmtOut *o)
+{
+    o->room = spare(o->buf);
+    o->w = o->room ? reserve(o->buf, o->room) : NULL;
+    if (!o->w) o->room = 0;
+    o->n = 0;
+}
+
+static void
+out_close (FmtOut *o)
+{
+    if (o->n) commit(o->buf, o->n);
+    o->done += o->n;
+    o->w = NULL;
+    o->room = o->n = 0;
+}
+
+// Position for `len` more bytes : in the room, else after growing once.
+static char*
+out_room (FmtOut *o, size_t len)
+{
+    if (o->w && len <= o->room - o->n) return o->w + o->n;
+    out_close(o);
+    if (!reserve(o->buf, len)) return NULL;
+    out_open(o);
+    return len <= o->room ? o->w : NULL;
+}
+
+static bool
+out_put (FmtOut *o, const char *src, size_t len)
+{
+    if (!len) return true;
+    char *w = out_room(o, len);
+    if (!w) return false;
+    memcpy(w, src, len);
+    o->n += len;
+    return true;
+}
+
+static bool
+out_i64 (FmtOut *o, int64_t val)
+{
+    const bool neg = val < 0;
+    const uint64_t mag = neg ? 0 - (uint64_t)val : (uint64_t)val;
+    const int len = neg + count_digits(mag);
+    char *w = out_room(o, len);
+    if (!w) return false;
+    *w = '-';
+    write_digits(w + len, mag);
+    o->n += len;
+    return true;
+}
+
+static bool
+out_u64 (FmtOut *o, uint64_t val, bool hex)
+{
+    const int len = hex ? hex_digits(val) : count_digits(val);
+    char *w = out_room(o, len);
+    if (!w) return false;
+    if (hex) write_hex(w, len, val);
+    else write_digits(w + len, val);
+    o->n += len;
+    return true;
+}
+
+// One conversion by printf, measured in the room, else formatted again 
+// once grown to its size.
+static bool
+out_spec (FmtOut *o, const char *spec, ArgType type, const FmtArg *arg)
+{
+    const size_t avail = o->room - o->n;
+    char *w = o->w ? o->w + o->n : NULL;
+    const int len = format1(w, w ? avail+1 : 0, spec, type, arg);
+    if (len <= 0) return !len;
+
+    if (!w || (size_t)len > avail) {
+        w = out_room(o, len);
+        if (!w) return false;
+        format1(w, len+1, spec, type, arg);
+    }
+
+    o->n += len;
+    return true;
+}
+
+/**
+ * Append printf-style formatted output, like bft_appendf() from a va_list.
+ * 
+ * @param[in,out] buf the Buffet
+ * @param[in] fmt the format
+ * @param[in] args the arguments
+ * @return new length, or zero on error
+ */
+size_t
+bft_vappendf (Buffet *buf, const char *fmt, va_list args)
+{
+    va_list ap;
+    va_copy(ap, args);
+    FmtOut out = {.buf = buf};
+    out_open(&out);
+    bool ok = true;
+    const char *p = fmt;
+
+    while (ok && *p) {
+
+        // literal run
+        const char *pct = strchr(p, '%');
+        const size_t lit = pct ? (size_t)(pct-p) : strlen(p);
+        if (lit && !out_put(&out, p, lit)) {ok = false; break;}
+        if (!pct) break;
+        p = pct+1;
+
+        // spec : flags, width, precision, length, conversion
+        char spec[128] = "%";
+        size_t sl = 1;
+
+        while (*p && strchr("-+ #0'", *p) && sl < 16) spec[sl++] = *p++;
+        for (int part = 0; part < 2; ++part) {
+            if (part) {
+                if (*p != '.') break;
+                spec[sl++] = *p++;
+            }
+            if (*p == '*') {
+                sl += sprintf(spec+sl, "%d", va_arg(ap, int));
+                ++p;
+            } else {
+                for (int i = 0; is_digit(*p) && i < 16; ++i) spec[sl++] = *p++;
+            }
+        }
+
+        const char *mod = p;
+        ArgType type = ARG_INT;
+
+        switch (*p) {
+            case 'h': p += 1 + (p[1] == 'h'); break;
+            case 'l': type = p[1] == 'l' ? ARG_LLONG : ARG_LONG; 
+                      p += 1 + (p[1] == 'l'); break;
+            case 'j': type = ARG_INTMAX; ++p; break;
+            case 'z': type = ARG_SIZE; ++p; break;
+            case 't': type = ARG_PTRDIFF; ++p; break;
+            case 'L': type = ARG_LDOUBLE; ++p; break;
+        }
+        while (mod < p) spec[sl++] = *mod++;
+        const bool plain = sl == 1; // no flags, width, precision or length
+
+        const char conv = *p++;
+        spec[sl++] = conv;
+        spec[sl] = 0;
+        FmtArg arg = {0};
+
+        switch (conv) {
+
+            case '%':
+                ok = out_put(&out, "%", 1);
+                break;
+
+            case 'B': {
+                const Buffet *b = va_arg(ap, const Buffet*);
+                const Tag tag = TAG(b);
+                ok = out_put(&out, getdata(b, tag), getlen(b, tag));
+                break;
+            }
+
+            case 's':
+                arg.p = va_arg(ap, const char*);
+                if (!plain) ok = out_spec(&out, spec, ARG_PTR, &arg);
+                else if (!arg.p) ok = out_put(&out, "(null)", 6);
+                else ok = out_put(&out, arg.p, strlen(arg.p));
+                break;
+
+            case 'p':
+                arg.p = va_arg(ap, const void*);
+                ok = out_spec(&out, spec, ARG_PTR, &arg);
+                break;
+
+            case 'd': case 'i':
+                switch (type) {
+                    case ARG_LONG: arg.i = va_arg(ap, long); break;
+                    case ARG_LLONG: arg.i = va_arg(ap, long long); break;
+                    case ARG_INTMAX: arg.i = va_arg(ap, intmax_t); break;
+                    case ARG_SIZE: arg.i = va_arg(ap, ssize_t); break;
+                    case ARG_PTRDIFF: arg.i = va_arg(ap, ptrdiff_t); break;
+                    default: arg.i = va_arg(ap, int);
+                }
+                if (plain) ok = out_i64(&out, arg.i);
+                else ok = out_spec(&out, spec, type, &arg);
+                break;
+
+            case 'c':
+                // int or wint_t, whatever the length
+                arg.u = va_arg(ap, unsigned);
+                ok = out_spec(&out, spec, ARG_INT, &arg);
+                break;
+
+            case 'u': case 'x': case 'X': case 'o':
+                switch (type) {
+                    case ARG_LONG: arg.u = va_arg(ap, unsigned long); break;
+                    case ARG_LLONG: arg.u = va_arg(ap, unsigned long long); break;
+                    case ARG_INTMAX: arg.u = va_arg(ap, uintmax_t); break;
+                    case ARG_SIZE: arg.u = va_arg(ap, size_t); break;
+                    case ARG_PTRDIFF: arg.u = va_arg(ap, ptrdiff_t); break;
+                    default: arg.u = va_arg(ap, unsigned);
+                }
+                if (plain && (conv == 'u' || conv == 'x')) 
+                    ok = out_u64(&out, arg.u, conv == 'x');
+                else 
+                    ok = out_spec(&out, spec, type, &arg);
+                break;
+
+            case 'e': case 'E': case 'f': case 'F': 
+            case 'g': case 'G': case 'a': case 'A':
+                if (type == ARG_LDOUBLE) arg.ld = va_arg(ap, long double);
+                else {arg.d = va_arg(ap, double); type = ARG_DOUBLE;}
+                ok = out_spec(&out, spec, type, &arg);
+                break;
+
+            default:
+                // %n, or malformed
+                WARN("bft_appendf: unsupported conversion '%c'\n", conv);
+                ok = false;
+        }
+    }
+
+    out_close(&out);
+    va_end(ap);
+    if (!ok) {
+        uncommit(buf, out.done);
+        return 0;
+    }
+    return getlen(buf, TAG(buf));
+}
+
+/**
+ * Append printf-style formatted output, directly into the Buffet's 
+ * spare room : conversions that overflow it grow the Buffet once 
+ * to their measured size. No temporary buffer.
+ * `%B` takes a `const Buffet*`, appended as is, without bft_cstr().
+ * Plain `%s`, `%d`, `%u`, `%x` skip printf. `%n` is not supported.
+ * 
+ * @param[in,out] buf the Buffet
+ * @param[in] fmt the format
+ * @return new length, or zero on error, `buf` unchanged
+ */
+size_t
+bft_appendf (Buffet *buf, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    const size_t ret = bft_vappendf(buf, fmt, args);
+    va_end(args);
+    return ret;
+}
+
+
+//============================================================================
+// Template
+//============================================================================
+
+// A literal run of the text, then a slot (or none, ending the template).
+struct BuffetTplPart {
+    size_t lit, litlen;     // in text
+    size_t name, namelen;   // in text, after the literals
+    int slot;               // argument index, or -1
+};
+
+typedef struct BuffetTplPart Part;
+
+static int
+tpl_lookup (const BuffetTemplate *tpl, const char *name, size_t len)
+{
+    for (int i = 0; i < tpl->cnt; ++i) {
+        const Part *part = &tpl->parts[i];
+        if (part->slot >= 0 && part->namelen == len 
+            && !memcmp(tpl->text + part->name, name, len)) return part->slot;
+    }
+    return -1;
+}
+
+/**
+ * Compile a pattern like "{host} - {path} {status}" into literal segments 
+ * and slots. Each distinct name is a slot, numbered by first appearance.
+ * `{{` and `}}` stand for literal braces.
+ * 
+ * @param[in] pattern the pattern
+ * @return the template, with `parts` NULL if the pattern is malformed
+ */
+BuffetTemplate
+bft_template (const char *pattern)
+{
+    BuffetTemplate tpl = BUFFET_TEMPLATE_ZERO;
+    const size_t patlen = strlen(pattern);
+    int maxparts = 1;
+    for (const char *c = pattern; (c = strchr(c, '{')); ++c) ++maxparts;
+
+    // literals from 0, names from patlen : neither outgrows its source
+    tpl.text = malloc(2*patlen+1);
+    tpl.parts = malloc(maxparts * sizeof(Part));
+    if (!tpl.text || !tpl.parts) {ERR_ALLOC; goto fail;}
+
+    size_t tl = 0, nl = patlen;
+    Part part = {.lit = 0};
+    const char *c = pattern;
+
+    while (*c) {
+
+        if ((*c == '{' || *c == '}') && c[1] == *c) {
+            tpl.text[tl++] = *c;
+            c += 2;
+            continue;
+        } 
+        
+        if (*c == '}') goto bad;
+        
+        if (*c != '{') {
+            tpl.text[tl++] = *c++;
+            continue;
+        }
+
+        const char *name = c+1;
+        const char *end = strpbrk(name, "{}");
+        if (!end || *end != '}' || end == name) goto bad;
+        
+        const size_t len = end-name;
+        part.litlen = tl - part.lit;
+        part.slot = tpl_lookup(&tpl, name, len);
+        part.name = nl;
+        part.namelen = len;
+        if (part.slot < 0) part.slot = tpl.slots++;
+        memcpy(tpl.text + nl, name, len);
+        nl += len;
+        tpl.fixed += part.litlen;
+        tpl.parts[tpl.cnt++] = part;
+
+        part = (Part){.lit = tl};
+        c = end+1;
+    }
+
+    part.litlen = tl - part.lit;
+    part.slot = -1;
+    tpl.fixed += part.litlen;
+    tpl.parts[tpl.cnt++] = part;
+    return tpl;
+
+    bad:
+    ERR("bad template at '%s'\n", c);
+    fail:
+    free(tpl.text);
+    free(tpl.parts);
+    return BUFFET_TEMPLATE_ZERO;
+}
+
+/**
+ * Argument index of a slot name, or -1.
+ * 
+ * @param[in] tpl the template
+ * @param[in] name the slot name, without braces
+ */
+int
+bft_template_slot (const BuffetTemplate *tpl, const char *name)
+{
+    return tpl_lookup(tpl, name, strlen(name));
+}
+
+/**
+ * Render a template : sized exactly, then one allocation (or SSO) 
+ * and a memcpy per segment.
+ * 
+ * @param[in] tpl the template
+ * @param[in] args a Buffet per slot
+ * @return the new Buffet
+ */
+Buffet
+bft_render (const BuffetTemplate *tpl, const Buffet *args)
+{
+    size_t totlen = tpl->fixed;
+
+    for (int i = 0; i < tpl->cnt; ++i) {
+        const int slot = tpl->parts[i].slot;
+        if (slot >= 0) totlen += getlen(&args[slot], TAG(&args[slot]));
+    }
+
+    Buffet ret = bft_new(totlen);
+    const Tag rettag = TAG(&ret);
+    if (rettag == SSO && totlen > BUFFET_SSOMAX) return ret;
+    char *cur = getdata(&ret, rettag);
+
+    for (int i = 0; i < tpl->cnt; ++i) {
+        const Part *part = &tpl->parts[i];
+        memcpy(cur, tpl->text + part->lit, part->litlen);
+        cur += part->litlen;
+        if (part->slot < 0) continue;
+        const Buffet *arg = &args[part->slot];
+        const Tag tag = TAG(arg);
+        const size_t len = getlen(arg, tag);
+        memcpy(cur, getdata(arg, tag), len);
+        cur += len;
+    }
+    *cur = 0;
+
+    if (rettag == SSO) ret.sso.len = totlen; 
+    else {
+        ret.ptr.len = totlen;
+        getstore(&ret)->len = totlen;
+    }
+
+    return ret;
+}
+
+/**
+ * Release a template.
+ * 
+ * @param[in,out] tpl the template, left empty
+ */
+void
+bft_template_free (BuffetTemplate *tpl)
+{
+    free(tpl->text);
+    free(tpl->parts);
+    *tpl = BUFFET_TEMPLATE_ZERO;
+}
+
+
+//============================================================================
+// Base64 & hex
+//============================================================================
+
+// AVX2 kernels after Muła & Lemire, "Faster Base64 Encoding and Decoding 
+// using AVX2 Instructions" : they stop at the first block they cannot 
+// take whole, the scalar code finishes and reports errors.
+
+static const char B64_ENC[] = 
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// 0..63, or X if not in the alphabet
+#define X 0xff
+static const uint8_t B64_DEC[256] = {
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, 62, X, X, X, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, X, X, X, X, X, X,
+    X, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, X, X, X, X, X,
+    X, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+};
+#undef X
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static inline int
+hex_value (uint8_t c)
+{
+    if ((unsigned)(c - '0') < 10) return c - '0';
+    c |= 0x20;
+    if ((unsigned)(c - 'a') < 6) return c - 'a' + 10;
+    return -1;
+}
+
+#ifdef SIMD_X86
+
+// 24 bytes -> 32 chars per round, reading 28 bytes ahead
+__attribute__((target("avx2")))
+static size_t
+b64_encode_avx2 (char *dst, const uint8_t *src, size_t len)
+{
+    const __m256i shuf = _mm256_setr_epi8(
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i shift_lut = _mm256_setr_epi8(
+        65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+        65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    size_t i = 0, o = 0;
+
+    for (; i+28 <= len; i += 24, o += 32) {
+        const __m256i in = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src+i))),
+            _mm_loadu_si128((const __m128i*)(src+i+12)), 1);
+        // 4 x 6 bits out of each 3 bytes
+        const __m256i v = _mm256_shuffle_epi8(in, shuf);
+        const __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i idx = _mm256_or_si256(t1, t3);
+        // to ASCII : offset by range of the index
+        __m256i range = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        range = _mm256_sub_epi8(range, 
+            _mm256_cmpgt_epi8(idx, _mm256_set1_epi8(25)));
+        const __m256i out = 
+            _mm256_add_epi8(idx, _mm256_shuffle_epi8(shift_lut, range));
+        _mm256_storeu_si256((__m256i*)(dst+o), out);
+    }
+
+    return i;
+}
+
+// 32 chars -> 24 bytes per round, storing 32 : needs `room` past dst.
+// Stops before a block with a non-alphabet char, or padding.
+// If `dst` is NULL, only validates.
+__attribute__((target("avx2")))
+static size_t
+b64_decode_avx2 (char *dst, size_t room, const uint8_t *src, size_t len)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    size_t i = 0, o = 0;
+
+    for (; i+32 <= len && (!dst || o+32 <= room); i += 32, o += 24) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src+i));
+        // classify by nibbles : any common bit is an invalid char
+        const __m256i hi_nib = 
+            _mm256_and_si256(_mm256_srli_epi32(v, 4), mask_2f);
+        const __m256i lo_nib = _mm256_and_si256(v, mask_2f);
+        const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nib);
+        const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nib);
+        if (!_mm256_testz_si256(lo, hi)) break;
+        if (!dst) continue;
+        // to 6-bit values, then packed 4 -> 3
+        const __m256i eq_2f = _mm256_cmpeq_epi8(v, mask_2f);
+        v = _mm256_add_epi8(v, 
+            _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nib)));
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, pack);
+        v = _mm256_permutevar8x32_epi32(v, 
+            _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+        _mm256_storeu_si256((__m256i*)(dst+o), v);
+    }
+
+    return i;
+}
+
+// 16 bytes -> 32 digits per round
+__attribute__((target("avx2")))
+static size_t
+hex_encode_avx2 (char *dst, const uint8_t *src, size_t len)
+{
+    const __m256i lut = _mm256_setr_epi8(
+        '0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f',
+        '0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f');
+    size_t i = 0;
+
+    for (; i+16 <= len; i += 16) {
+        const __m256i x = _mm256_cvtepu8_epi16(
+            _mm_loadu_si128((const __m128i*)(src+i)));
+        // high nibble in the first byte of each pair
+        const __m256i nib = _mm256_or_si256(_mm256_srli_epi16(x, 4),
+            _mm256_slli_epi16(_mm256_and_si256(x, _mm256_set1_epi16(15)), 8));
+        _mm256_storeu_si256((__m256i*)(dst+2*i), _mm256_shuffle_epi8(lut, nib));
+    }
+
+    return i;
+}
+
+// 32 digits -> 16 bytes per round. Stops before a block with a non-digit.
+// If `dst` is NULL, only validates.
+__attribute__((target("avx2")))
+static size_t
+hex_decode_avx2 (char *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i+32 <= len; i += 32) {
+        const __m256i c = _mm256_loadu_si256((const __m256i*)(src+i));
+        const __m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+        const __m256i isdig = 
+            _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+        const __m256i l = _mm256_sub_epi8(
+            _mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+        const __m256i islet = 
+            _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+        if (~_mm256_movemask_epi8(_mm256_or_si256(isdig, islet))) break;
+        if (!dst) continue;
+        const __m256i val = _mm256_blendv_epi8(
+            _mm256_add_epi8(l, _mm256_set1_epi8(10)), d, isdig);
+        // pairs to bytes : hi*16 + lo
+        const __m256i w = _mm256_maddubs_epi16(val, _mm256_set1_epi16(0x0110));
+        const __m256i b = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(w, w), 0x08);
+        _mm_storeu_si128((__m128i*)(dst+i/2), _mm256_castsi256_si128(b));
+    }
+
+    return i;
+}
+
+#endif
+
+static void
+b64_encode (char *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0, o = 0;
+
+    #ifdef SIMD_X86
+    if (len >= 28 && HAS_AVX2) {
+        i = b64_encode_avx2(dst, src, len);
+        o = i/3*4;
+    }
+    #endif
+
+    for (; i+3 <= len; i += 3, o += 4) {
+        const uint32_t v = src[i] << 16 | src[i+1] << 8 | src[i+2];
+        dst[o] = B64_ENC[v >> 18];
+        dst[o+1] = B64_ENC[v >> 12 & 63];
+        dst[o+2] = B64_ENC[v >> 6 & 63];
+        dst[o+3] = B64_ENC[v & 63];
+    }
+
+    if (i < len) {
+        const uint32_t v = src[i] << 16 | (i+1 < len ? src[i+1] << 8 : 0);
+        dst[o] = B64_ENC[v >> 18];
+        dst[o+1] = B64_ENC[v >> 12 & 63];
+        dst[o+2] = i+1 < len ? B64_ENC[v >> 6 & 63] : '=';
+        dst[o+3] = '=';
+    }
+}
+
+// Decode to `dst`, at or behind `src`, with `room` bytes writable.
+// If `dst` is NULL, only validates. 
+// Returns the decoded length, or -1 if invalid.
+static ptrdiff_t
+b64_decode (char *dst, size_t room, const uint8_t *src, size_t len)
+{
+    if (len % 4 == 0 && len && src[len-1] == '=') len -= 1 + (src[len-2] == '=');
+    if (len % 4 == 1) return -1;
+
+    size_t i = 0, o = 0;
+
+    #ifdef SIMD_X86
+    if (len >= 32 && HAS_AVX2) {
+        i = b64_decode_avx2(dst, room, src, len);
+        o = i/4*3;
+    }
+    #endif
+
+    for (; i+4 <= len; i += 4, o += 3) {
+        const uint32_t a = B64_DEC[src[i]], b = B64_DEC[src[i+1]],
+            c = B64_DEC[src[i+2]], d = B64_DEC[src[i+3]];
+        if ((a | b | c | d) > 63) return -1;
+        if (!dst) continue;
+        const uint32_t v = a << 18 | b << 12 | c << 6 | d;
+        dst[o] = v >> 16;
+        dst[o+1] = v >> 8;
+        dst[o+2] = v;
+    }
+
+    if (i < len) {
+        const uint32_t a = B64_DEC[src[i]], b = B64_DEC[src[i+1]],
+            c = i+2 < len ? B64_DEC[src[i+2]] : 0;
+        if ((a | b | c) > 63) return -1;
+        const uint32_t v = a << 18 | b << 12 | c << 6;
+        if (dst) dst[o] = v >> 16;
+        if (dst && i+2 < len) dst[o+1] = v >> 8;
+        o += len-i-1;
+    }
+
+    return o;
+}
+
+static void
+hex_encode (char *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+
+    #ifdef SIMD_X86
+    if (len >= 16 && HAS_AVX2) i = hex_encode_avx2(dst, src, len);
+    #endif
+
+    for (; i < len; ++i) {
+        dst[2*i] = HEX_DIGITS[src[i] >> 4];
+        dst[2*i+1] = HEX_DIGITS[src[i] & 15];
+    }
+}
+
+// Decode to `dst`, at or behind `src`. If `dst` is NULL, only validates.
+// Returns the decoded length, or -1 if invalid.
+static ptrdiff_t
+hex_decode (char *dst, const uint8_t *src, size_t len)
+{
+    if (len % 2) return -1;
+    size_t i = 0;
+
+    #ifdef SIMD_X86
+    if (len >= 32 && HAS_AVX2) i = hex_decode_avx2(dst, src, len);
+    #endif
+
+    for (; i < len; i += 2) {
+        const int hi = hex_value(src[i]), lo = hex_value(src[i+1]);
+        if ((hi | lo) < 0) return -1;
+        if (dst) dst[i/2] = hi << 4 | lo;
+    }
+
+    return len/2;
+}
+
+// Replace `buf` by its decoding, in place if writable, else into a new 
+// Buffet. Invalid input leaves `buf` untouched.
+static bool
+decode (Buffet *buf, bool b64)
+{
+    const Tag tag = TAG(buf);
+    const uint8_t *src = (const uint8_t*)getdata(buf, tag);
+    const size_t len = getlen(buf, tag);
+
+    if (tag==SSO && buf->sso.rfc) {
+        WARN("Mutation would alter views on SSO\n");
+        return false;
+    }
+
+    // validated first : a failure must not leave `buf` half-decoded
+    char *dst = inplace(buf);
+    if (dst) {
+        const ptrdiff_t n = b64 ? b64_decode(NULL, 0, src, len) 
+                                : hex_decode(NULL, src, len);
+        if (n < 0) return false;
+        if (b64) b64_decode(dst, len, src, len);
+        else hex_decode(dst, src, len);
+        shrink(buf, n);
+        return true;
+    }
+
+    Buffet out;
+    const size_t outlen = b64 ? len/4*3 + len%4*3/4 : len/2;
+    if (!(dst = sized(&out, outlen))) return false;
+    const size_t room = TAG(&out)==SSO ? BUFFET_SSOMAX : outlen;
+    const ptrdiff_t n = b64 ? b64_decode(dst, room, src, len) 
+                            : hex_decode(dst, src, len);
+    if (n < 0) {bft_free(&out); return false;}
+    shrink(&out, n);
+    bft_free(buf);
+    *buf = out;
+    return true;
+}
+
+/**
+ * Encode a Buffet's bytes to base64 (RFC 4648, padded), 
+ * straight into a new Buffet of the exact size.
+ * 
+ * @param[in] src the source Buffet
+ * @return the new Buffet
+ */
+Buffet
+bft_base64_encode (const Buffet *src)
+{
+    const Tag tag = TAG(src);
+    const size_t len = getlen(src, tag);
+    Buffet ret;
+    char *dst = sized(&ret, (len+2)/3*4);
+    if (!dst) return ZERO;
+    b64_encode(dst, (const uint8_t*)getdata(src, tag), len);
+    dst[(len+2)/3*4] = 0;
+    return ret;
+}
+
+/**
+ * Decode base64 (RFC 4648, padding optional) in place if `buf` is an SSO 
+ * or the sole owner of its store, else into a new Buffet.
+ * 
+ * @param[in,out] buf the Buffet
+ * @return false if invalid, leaving `buf` untouched, or on allocation failure
+ */
+bool
+bft_base64_decode (Buffet *buf)
+{
+    return decode(buf, true);
+}
+
+/**
+ * Encode a Buffet's bytes to lowercase hex, like bft_base64_encode().
+ * 
+ * @param[in] src the source Buffet
+ * @return the new Buffet
+ */
+Buffet
+bft_hex_encode (const Buffet *src)
+{
+    const Tag tag = TAG(src);
+    const size_t len = getlen(src, tag);
+    Buffet ret;
+    char *dst = sized(&ret, 2*len);
+    if (!dst) return ZERO;
+    hex_encode(dst, (const uint8_t*)getdata(src, tag), len);
+    dst[2*len] = 0;
+    return ret;
+}
+
+/**
+ * Decode hex digits of either case, like bft_base64_decode().
+ * 
+ * @param[in,out] buf the Buffet
+ * @return false if invalid, leaving `buf` untouched, or on allocation failure
+ */
+bool
+bft_hex_decode (Buffet *buf)
+{
+    return decode(buf, false);
+}
+
+
+//============================================================================
+// JSON
+//============================================================================
+
+// Bytes needing a JSON string escape : '"', '\\' and controls below 0x20.
+static inline bool
+json_special (uint8_t c) {
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+#ifdef SIMD_X86
+
+static size_t
+json_scan_sse2 (const uint8_t *p, size_t len)
+{
+    const __m128i ctl = _mm_set1_epi8(0x1f);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    size_t i = 0;
+
+    for (; i+16 <= len; i += 16) {
+        const __m128i c = _mm_loadu_si128((const __m128i*)(p+i));
+        const __m128i hit = _mm_or_si128(
+            _mm_cmpeq_epi8(_mm_min_epu8(c, ctl), c),
+            _mm_or_si128(_mm_cmpeq_epi8(c, quote), _mm_cmpeq_epi8(c, bslash)));
+        const unsigned m = _mm_movemask_epi8(hit);
+        if (m) return i + __builtin_ctz(m);
+    }
+    for (; i < len && !json_special(p[i]); ++i) {}
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t
+json_scan_avx2 (const uint8_t *p, size_t len)
+{
+    const __m256i ctl = _mm256_set1_epi8(0x1f);
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i bslash = _mm256_set1_epi8('\\');
+    size_t i = 0;
+
+    for (; i+32 <= len; i += 32) {
+        const __m256i c = _mm256_loadu_si256((const __m256i*)(p+i));
+        const __m256i hit = _mm256_or_si256(
+            _mm256_cmpeq_epi8(_mm256_min_epu8(c, ctl), c),
+            _mm256_or_si256(_mm256_cmpeq_epi8(c, quote), 
+                            _mm256_cmpeq_epi8(c, bslash)));
+        const unsigned m = _mm256_movemask_epi8(hit);
+        if (m) return i + __builtin_ctz(m);
+    }
+    return i + json_scan_sse2(p+i, len-i);
+}
+
+#endif
+
+// Offset of the first byte needing an escape, or `len`.
+static size_t
+json_scan (const uint8_t *p, size_t len)
+{
+    #ifdef SIMD_X86
+    if (len >= 32 && HAS_AVX2) return json_scan_avx2(p, len);
+    return json_scan_sse2(p, len);
+    #else
+    size_t i = 0;
+    for (; i < len && !json_special(p[i]); ++i) {}
+    return i;
+    #endif
+}
+
+// Escape of special byte `c` : "\n"-like short form, else "\u00XX".
+static inline int
+json_escape_byte (char *dst, uint8_t c)
+{
+    static const char SHORT[32] = {
+        [8] = 'b', [9] = 't', [10] = 'n', [12] = 'f', [13] = 'r'};
+    dst[0] = '\\';
+    if (c == '"' || c == '\\') {dst[1] = c; return 2;}
+    if (SHORT[c]) {dst[1] = SHORT[c]; return 2;}
+    memcpy(dst+1, "u00", 3);
+    dst[4] = HEX_DIGITS[c >> 4];
+    dst[5] = HEX_DIGITS[c & 15];
+    return 6;
+}
+
+/**
+ * Escape a Buffet's bytes for the inside of a JSON string : `"`, `\` and 
+ * controls. Other bytes, UTF-8 included, are kept.
+ * With nothing to escape, returns bft_dup(src) : no copy of heap data.
+ * Else writes the escaped text into one allocation of the exact size.
+ * 
+ * @param[in] src the source Buffet
+ * @return the new Buffet
+ */
+Buffet
+bft_json_escape (const Buffet *src)
+{
+    const Tag tag = TAG(src);
+    const uint8_t *data = (const uint8_t*)getdata(src, tag);
+    const size_t len = getlen(src, tag);
+
+    size_t at = json_scan(data, len);
+    if (at == len) return bft_dup(src);
+
+    // size : each special grows by 1, or 5 if \u-escaped
+    size_t outlen = len;
+    char esc[6];
+    for (size_t i = at; i < len; ++i) {
+        i += json_scan(data+i, len-i);
+        if (i < len) outlen += json_escape_byte(esc, data[i]) - 1;
+    }
+
+    Buffet ret;
+    char *dst = sized(&ret, outlen);
+    if (!dst) return ZERO;
+
+    size_t pos = 0, w = 0;
+    while (at < len) {
+        memcpy(dst+w, data+pos, at-pos);
+        w += at-pos;
+        w += json_escape_byte(dst+w, data[at]);
+        pos = at+1;
+        at = pos + json_scan(data+pos, len-pos);
+    }
+    memcpy(dst+w, data+pos, len-pos);
+    dst[outlen] = 0;
+
+    return ret;
+}
+
+static inline int
+hex4 (const uint8_t *p)
+{
+    int v = 0;
+    for (int i = 0; i < 4; ++i) {
+        const int d = hex_value(p[i]);
+        if (d < 0) return -1;
+        v = v << 4 | d;
+    }
+    return v;
+}
+
+/**
+ * Unescape the inside of a JSON string : `\"`, `\\`, `\/`, `\b`, `\f`, 
+ * `\n`, `\r`, `\t` and `\uXXXX`, surrogate pairs to UTF-8.
+ * With no backslash, `out` is bft_dup(src) : no copy of heap data.
+ * Else the text is written into one allocation.
+ * 
+ * @param[in] src the source Buffet
+ * @param[out] out the unescaped Buffet
+ * @return false if an escape is malformed or a surrogate unpaired, 
+ * leaving `out` untouched, or on allocation failure
+ */
+bool
+bft_json_unescape (const Buffet *src, Buffet *out)
+{
+    const Tag tag = TAG(src);
+    const uint8_t *data = (const uint8_t*)getdata(src, tag);
+    const size_t len = getlen(src, tag);
+
+    const uint8_t *esc = memchr(data, '\\', len);
+    if (!esc) {
+        *out = bft_dup(src);
+        return true;
+    }
+
+    // escapes only shrink : sized for `len`, cut after
+    Buffet ret;
+    char *dst = sized(&ret, len);
+    if (!dst) return false;
+
+    const uint8_t *p = data, *end = data+len;
+    size_t w = 0;
+
+    while (esc) {
+        memcpy(dst+w, p, esc-p);
+        w += esc-p;
+        p = esc+1;
+        if (p == end) goto bad;
+        const uint8_t c = *p++;
+
+        switch (c) {
+            case '"': case '\\': case '/': dst[w++] = c; break;
+            case 'b': dst[w++] = '\b'; break;
+            case 'f': dst[w++] = '\f'; break;
+            case 'n': dst[w++] = '\n'; break;
+            case 'r': dst[w++] = '\r'; break;
+            case 't': dst[w++] = '\t'; break;
+            
+            case 'u': {
+                if (end-p < 4) goto bad;
+                uint32_t cp = hex4(p);
+                p += 4;
+                if (cp >= 0xDC00 && cp <= 0xDFFF) goto bad;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    if (end-p < 6 || p[0] != '\\' || p[1] != 'u') goto bad;
+                    const int lo = hex4(p+2);
+                    if (lo < 0xDC00 || lo > 0xDFFF) goto bad;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    p += 6;
+                }
+                // hex4() error is negative, so cp is huge
+                if (cp > 0x10FFFF) goto bad;
+                if (cp < 0x80) {
+                    dst[w++] = cp;
+                } else if (cp < 0x800) {
+                    dst[w++] = 0xC0 | cp >> 6;
+                    dst[w++] = 0x80 | (cp & 0x3F);
+                } else if (cp < 0x10000) {
+                    dst[w++] = 0xE0 | cp >> 12;
+                    dst[w++] = 0x80 | (cp >> 6 & 0x3F);
+                    dst[w++] = 0x80 | (cp & 0x3F);
+                } else {
+                    dst[w++] = 0xF0 | cp >> 18;
+                    dst[w++] = 0x80 | (cp >> 12 & 0x3F);
+                    dst[w++] = 0x80 | (cp >> 6 & 0x3F);
+                    dst[w++] = 0x80 | (cp & 0x3F);
+                }
+                break;
+            }
+            
+            default: goto bad;
+        }
+
+        esc = memchr(p, '\\', end-p);
+    }
+
+    memcpy(dst+w, p, end-p);
+    w += end-p;
+    shrink(&ret, w);
+    *out = ret;
+    return true;
+
+    bad:
+    bft_free(&ret);
+    return false;
+}
+
+
+//============================================================================
+// Hash
+//============================================================================
+
+// wyhash-style multiply-mix for short and medium inputs, 
+// xxh3-style lanes over 64-byte stripes for long ones.
+// Values depend on host endianness : not for persistence.
+
+static const uint64_t HSECRET[8] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 
+    0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull,
+    0x1d8e4e27c47d124full, 0x9e3779b97f4a7c15ull,
+    0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull,
+};
+
+#define HASH_LONG 1024      // from which lanes pay off
+#define HASH_STRIPE 64      // bytes per lanes round
+#define HASH_SCRAMBLE 16    // stripes between scrambles
+#define HASH_PRIME32 0x9e3779b1u
+
+static inline uint64_t
+rd64 (const char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+// 128-bit product folded, operands kept in : no collapse on a zero factor.
+static inline uint64_t
+hmix (uint64_t a, uint64_t b) {
+    const __uint128_t r = (__uint128_t)a * b;
+    return (a ^ (uint64_t)r) ^ (b ^ (uint64_t)(r >> 64));
+}
+
+static inline uint64_t
+hash_final (uint64_t h, size_t len) {
+    return hmix(h ^ HSECRET[6], len ^ HSECRET[7]);
+}
+
+// Up to 24 bytes, as three zero-padded words.
+static inline uint64_t
+hash_short (uint64_t w0, uint64_t w1, uint64_t w2, size_t len) {
+    uint64_t h = hmix(w0 ^ HSECRET[0], w1 ^ HSECRET[1]);
+    if (len > 16) h = hmix(h ^ HSECRET[2], w2 ^ HSECRET[3]);
+    return hash_final(h, len);
+}
+
+static inline uint32_t
+rd32 (const char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// Up to 24 bytes : zero-padded words by overlapping loads, 
+// the bytes of a tail load already taken shifted out.
+static inline uint64_t
+hash_upto24 (const char *p, size_t len)
+{
+    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const unsigned char *u = (const unsigned char*)p;
+    uint64_t w0 = 0, w1 = 0, w2 = 0;
+
+    if (len >= 8) {
+        w0 = rd64(p);
+        if (len > 16) {
+            w1 = rd64(p+8);
+            w2 = rd64(p+len-8) >> 8*(24-len);
+        } else if (len > 8) {
+            w1 = rd64(p+len-8) >> 8*(16-len);
+        }
+    } else if (len >= 4) {
+        w0 = rd32(p) | ((uint64_t)rd32(p+len-4) >> 8*(8-len)) << 32;
+    } else if (len) {
+        w0 = u[0] | (len > 1 ? u[1] << 8 : 0) | (len > 2 ? u[2] << 16 : 0);
+    }
+
+    return hash_short(w0, w1, w2, len);
+    #else
+    uint64_t w[3] = {0};
+    memcpy(w, p, len);
+    return hash_short(w[0], w[1], w[2], len);
+    #endif
+}
+
+// Over 16 bytes, by chained 16-byte rounds and an overlapping last one.
+static uint64_t
+hash_medium (const char *p, size_t len)
+{
+    uint64_t h = HSECRET[4] ^ len;
+    size_t i = 0;
+    for (; i+16 < len; i += 16) 
+        h = hmix(rd64(p+i) ^ HSECRET[0], rd64(p+i+8) ^ h);
+    h = hmix(rd64(p+len-16) ^ HSECRET[2] ^ h, rd64(p+len-8) ^ HSECRET[3]);
+    return hash_final(h, len);
+}
+
+// One stripe into the 8 lanes : 32x32 product of keyed input, 
+// plus the raw input of the neighbour lane.
+static inline void
+hash_stripe (uint64_t acc[8], const char *p)
+{
+    for (int i = 0; i < 8; ++i) {
+        const uint64_t v = rd64(p + 8*i);
+        const uint64_t k = v ^ HSECRET[i];
+        acc[i^1] += v;
+        acc[i] += (k & 0xffffffff) * (k >> 32);
+    }
+}
+
+static inline void
+hash_scramble (uint64_t acc[8])
+{
+    for (int i = 0; i < 8; ++i) 
+        acc[i] = (acc[i] ^ (acc[i] >> 47) ^ HSECRET[i]) * HASH_PRIME32;
+}
+
+// `n` stripes, scrambled every HASH_SCRAMBLE
+static void
+hash_lanes (uint64_t acc[8], const char *p, size_t n)
+{
+    for (size_t s = 0; s < n; ++s) {
+        hash_stripe(acc, p + s*HASH_STRIPE);
+        if ((s+1) % HASH_SCRAMBLE == 0) hash_scramble(acc);
+    }
+}
+
+#ifdef SIMD_X86
+
+// Same as hash_lanes(), 4 lanes per register.
+__attribute__((target("avx2")))
+static void
+hash_lanes_avx2 (uint64_t acc[8], const char *p, size_t n)
+{
+    __m256i a0 = _mm256_loadu_si256((const __m256i*)acc);
+    __m256i a1 = _mm256_loadu_si256((const __m256i*)(acc+4));
+    const __m256i k0 = _mm256_loadu_si256((const __m256i*)HSECRET);
+    const __m256i k1 = _mm256_loadu_si256((const __m256i*)(HSECRET+4));
+    const __m256i prime = _mm256_set1_epi32(HASH_PRIME32);
+
+    #define STRIPE(a, d, k) { \
+        const __m256i dk = _mm256_xor_si256(d, k); \
+        const __m256i prod = _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32)); \
+        const __m256i swap = _mm256_shuffle_epi32(d, _MM_SHUFFLE(1,0,3,2)); \
+        a = _mm256_add_epi64(a, _mm256_add_epi64(prod, swap)); \
+    }
+    #define SCRAMBLE(a, k) { \
+        __m256i x = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47)); \
+        x = _mm256_xor_si256(x, k); \
+        const __m256i lo = _mm256_mul_epu32(x, prime); \
+        const __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), prime); \
+        a = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32)); \
+    }
+
+    for (size_t s = 0; s < n; ++s) {
+        const char *stripe = p + s*HASH_STRIPE;
+        STRIPE(a0, _mm256_loadu_si256((const __m256i*)stripe), k0);
+        STRIPE(a1, _mm256_loadu_si256((const __m256i*)(stripe+32)), k1);
+        if ((s+1) % HASH_SCRAMBLE == 0) {
+            SCRAMBLE(a0, k0);
+            SCRAMBLE(a1, k1);
+        }
+    }
+
+    #undef STRIPE
+    #undef SCRAMBLE
+
+    _mm256_storeu_si256((__m256i*)acc, a0);
+    _mm256_storeu_si256((__m256i*)(acc+4), a1);
+}
+
+#endif
+
+static uint64_t
+hash_long (const char *p, size_t len)
+{
+    uint64_t acc[8] = {
+        HASH_PRIME32, HSECRET[0], HSECRET[1], HSECRET[2],
+        HSECRET[3], HSECRET[4], HSECRET[5], HASH_PRIME32
+    };
+
+    // full stripes but the last, taken overlapping
+    const size_t n = (len-1) / HASH_STRIPE;
+
+    #ifdef SIMD_X86
+    if (HAS_AVX2) hash_lanes_avx2(acc, p, n); else
+    #endif
+    hash_lanes(acc, p, n);
+
+    hash_stripe(acc, p + len - HASH_STRIPE);
+
+    uint64_t h = len * HSECRET[5];
+    for (int i = 0; i < 8; i += 2) 
+        h += hmix(acc[i] ^ HSECRET[i], acc[i+1] ^ HSECRET[i+1]);
+
+    return hash_final(h, len);
+}
+
+static uint64_t
+hash_bytes (const char *p, size_t len)
+{
+    if (len <= 24) return hash_upto24(p, len);
+    return len < HASH_LONG ? hash_medium(p, len) : hash_long(p, len);
+}
+
+// Bytes of a word below `n`, as loaded little-endian.
+static inline uint64_t
+lowbytes (uint64_t w, long n) {
+    return n >= 8 ? w : n <= 0 ? 0 : w & ((1ull << 8*n) - 1);
+}
+
+// SSO : the three words of the fixed layout, loaded whole then masked.
+static inline uint64_t
+hash_sso (const Buffet *buf)
+{
+    const long len = buf->sso.len;
+
+    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t w[3];
+    memcpy(w, buf, sizeof(w));
+    return hash_short(lowbytes(w[0], len), lowbytes(w[1], len-8), 
+        lowbytes(w[2], len-16), len);
+    #else
+    return hash_bytes(buf->sso.data, len);
+    #endif
+}
+
+/**
+ * Hash a Buffet's data, fast and non-cryptographic.
+ * Equal data hash equal, whatever the Buffet kind.
+ * The hash of an OWN Buffet spanning its whole store is cached 
+ * in the store until the next write to it. Co-owners may be hashed 
+ * concurrently : the cache is filled atomically.
+ * 
+ * @param[in] buf the Buffet
+ * @return the 64-bit hash
+ */
+uint64_t
+bft_hash (const Buffet *buf)
+{
+    const Tag tag = TAG(buf);
+
+    if (tag==SSO) return hash_sso(buf);
+
+    const char *data = buf->ptr.data;
+    const size_t len = buf->ptr.len;
+
+    if (tag==OWN && !buf->ptr.off) {
+        Store *store = getstore(buf);
+        if (len == store->len) {
+            if (store_cached(store, STORE_HASHED)) 
+                return __atomic_load_n(&store->hash, __ATOMIC_RELAXED);
+            const uint64_t h = hash_bytes(data, len);
+            __atomic_store_n(&store->hash, h, __ATOMIC_RELAXED);
+            store_cache(store, STORE_HASHED);
+            return h;
+        }
+    }
+
+    return hash_bytes(data, len);
+}
+
+
+// Batches : 8 lanes of short keys, loaded zero-padded by masked loads, 
+// then mixed together with hmix() emulated on 32x32 products. 
+// With AVX2 (4 lanes) the emulation measured no faster than scalar.
+
+#define HASH_LANES 8
+
+#ifdef SIMD_X86
+
+#define HAS_AVX512 (__builtin_cpu_supports("avx512f") \
+    && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl") \
+    && __builtin_cpu_supports("bmi2"))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,bmi2")))
+
+// hmix() of 8 lanes
+TARGET_AVX512
+static inline __m512i
+hmix_x8 (__m512i a, __m512i b)
+{
+    const __m512i m32 = _mm512_set1_epi64(0xffffffff);
+    const __m512i ah = _mm512_srli_epi64(a, 32);
+    const __m512i bh = _mm512_srli_epi64(b, 32);
+    const __m512i ll = _mm512_mul_epu32(a, b);
+    const __m512i lh = _mm512_mul_epu32(a, bh);
+    const __m512i hl = _mm512_mul_epu32(ah, b);
+    const __m512i hh = _mm512_mul_epu32(ah, bh);
+    const __m512i mid = _mm512_add_epi64(_mm512_srli_epi64(ll, 32), 
+        _mm512_add_epi64(_mm512_and_si512(lh, m32), _mm512_and_si512(hl, m32)));
+    const __m512i lo = _mm512_or_si512(_mm512_and_si512(ll, m32), 
+        _mm512_slli_epi64(mid, 32));
+    const __m512i hi = _mm512_add_epi64(
+        _mm512_add_epi64(hh, _mm512_srli_epi64(lh, 32)), 
+        _mm512_add_epi64(_mm512_srli_epi64(hl, 32), _mm512_srli_epi64(mid, 32)));
+    // a ^ lo ^ b ^ hi
+    return _mm512_ternarylogic_epi64(_mm512_xor_si512(a, lo), b, hi, 0x96);
+}
+
+TARGET_AVX512
+static inline __m512i
+xor_secret (__m512i v, int i) {
+    return _mm512_xor_si512(v, _mm512_set1_epi64(HSECRET[i]));
+}
+
+// Same as hash_short() on HASH_LANES parts. Longer keys go to bft_hash().
+TARGET_AVX512
+static void
+hash_batch_avx512 (const Buffet *parts, uint64_t *out)
+{
+    uint64_t w[HASH_LANES][4];
+    uint64_t lens[HASH_LANES];
+    unsigned longs = 0;
+
+    for (int k = 0; k < HASH_LANES; ++k) {
+        const Buffet *part = &parts[k];
+        const Tag tag = TAG(part);
+        size_t len = getlen(part, tag);
+        lens[k] = len;
+        if (len > 24) {longs |= 1u << k; len = 0;}
+        const __mmask32 m = _bzhi_u32(0xffffffff, len);
+        _mm256_storeu_si256((__m256i*)w[k], 
+            _mm256_maskz_loadu_epi8(m, getdata(part, tag)));
+    }
+
+    // transpose : word i of every lane
+    const __m512i idx = _mm512_setr_epi64(0, 4, 8, 12, 16, 20, 24, 28);
+    const __m512i w0 = _mm512_i64gather_epi64(idx, &w[0][0], 8);
+    const __m512i w1 = _mm512_i64gather_epi64(idx, &w[0][1], 8);
+    const __m512i w2 = _mm512_i64gather_epi64(idx, &w[0][2], 8);
+    const __m512i len = _mm512_loadu_si512(lens);
+
+    __m512i h = hmix_x8(xor_secret(w0, 0), xor_secret(w1, 1));
+    const __m512i h24 = hmix_x8(xor_secret(h, 2), xor_secret(w2, 3));
+    h = _mm512_mask_blend_epi64(
+        _mm512_cmpgt_epu64_mask(len, _mm512_set1_epi64(16)), h, h24);
+    h = hmix_x8(xor_secret(h, 6), xor_secret(len, 7));
+    _mm512_storeu_si512(out, h);
+
+    while (longs) {
+        const int k = __builtin_ctz(longs);
+        out[k] = bft_hash(&parts[k]);
+        longs &= longs-1;
+    }
+}
+
+#endif
+
+typedef struct {
+    const Buffet *parts;
+    uint64_t *out;
+} HashJob;
+
+static void
+hash_many_run (void *job, size_t beg, size_t end)
+{
+    HashJob *j = job;
+    size_t i = beg;
+
+    #ifdef SIMD_X86
+    if (HAS_AVX512) 
+        for (; i+HASH_LANES <= end; i += HASH_LANES) 
+            hash_batch_avx512(j->parts + i, j->out + i);
+    #endif
+
+    for (; i < end; ++i) j->out[i] = bft_hash(&j->parts[i]);
+}
+
+/**
+ * Hash a list of Buffets, same as bft_hash() on each, 
+ * spread over the parallel pool. With AVX-512, short keys are 
+ * hashed 8 at a time in vector lanes, whatever their kind.
+ * Meant for hash-join and group-by over bft_split() output.
+ * 
+ * @param[in] parts the Buffet array
+ * @param[in] cnt the array length
+ * @param[out] out the `cnt` hashes
+ */
+void
+bft_hash_many (const Buffet *parts, int cnt, uint64_t *out)
+{
+    if (cnt <= 0) return;
+    HashJob job = {parts, out};
+    par_run(hash_many_run, &job, cnt);
+}
+
+
+/**
+ * Get a Buffet data as a null-terminated C string of length buf.len.
+ * 
+ * @param[in] buf the Buffet source
+ * @param[out] mustfree output flag set if the return must be freed
+ * @return the c-string data
+ */
+const char*
+bft_cstr (const Buffet *buf, bool *mustfree) 
+{
+    Tag tag = TAG(buf);
+    const size_t len = getlen(buf, tag);
+    bool tofree = false;
+    char *ret = NULL;
+
+    if (!len) {
+        ret = ""; //calloc(1) ?
+    } else if (tag==SSO) {
+        ret = (char*)buf->sso.data;
+    } else {
+        const char *data = buf->ptr.data;
+        if (data[len]==0) {
+            ret = (char*)data;
+        } else {
+            ret = malloc(len+1);
+            if (!ret) {
+                ERR_ALLOC;
+                ret = calloc(1,1);
+            } else {
+                memcpy(ret, data, len);
+                ret[len] = 0;
+            }
+            tofree = true;
+        }               
+    }
+
+    *mustfree = tofree;
+    return ret;
+}
+
+
+/**
+ * Get a null-terminated copy of a Buffet data.
+ * @param[in] buf the Buffet source
+ * @return string copy that must be freed, or NULL on error
+ */
+char*
+bft_export (const Buffet* buf) 
+{
+    const Tag tag = TAG(buf);
+    const size_t len = getlen(buf,tag);
+    const char* data = getdata(buf,tag);
+    char* ret = malloc(len+1);
+
+    if (!ret) {
+        ERR_ALLOC; return NULL;
+    } else {
+        memcpy(ret, data, len);
+    }
+
+    ret[len] = 0;
+    return ret;
+}
+
+
+/**
+ * Get a Buffet read-only data pointer.
+ * @param[in] buf the Buffet source
+ */
+const char*
+bft_data (const Buffet* buf) {
+    return getdata(buf, TAG(buf));
+}
+
+/**
+ * Get a Buffet length.
+ * @param[in] buf the Buffet source
+ */
+size_t
+bft_len (const Buffet* buf) {
+    return getlen(buf, TAG(buf));
+}
+
+/**
+ * Get a Buffet total capacity.
+ * @param[in] buf the Buffet source
+ */
+size_t
+bft_cap (const Buffet* buf) {
+    Tag tag = TAG(buf);
+    if (tag==SSO) return BUFFET_SSOMAX;
+    if (tag==OWN) {
+        Store* store = getstore(buf);
+        #if MEMCHECK
+            if (store->canary != CANARY) {WARN_CANARY; return 0;}
+        #endif
+
+        return store->cap;
+    }
+    return 0;
+}
+
+/**
+ * Print a Buffet data
+ * @param[in] buf the Buffet source
+ */
+void
+bft_print (const Buffet *buf) {
+    Tag tag = TAG(buf);
+    printf("%.*s\n", (int)getlen(buf,tag), getdata(buf,tag));
+    fflush(stdout);
+}
+
+/**
+ * Print a Buffet state.
+ * @param[in] buf the Buffet source
+ */
+void 
+bft_dbg (const Buffet* buf) {
+    dbg(buf);
+}
+
+
+//============================================================================
+// Sort
+//============================================================================
+
+// Entries sort by 8-byte big-endian keys of the data, so that comparing 
+// keys is comparing prefixes. Runs of equal keys are refined on the next 
+// 8 bytes, down to SORT_MAXDEPTH, then by bft_cmp().
+
+typedef struct {
+    uint64_t key;
+    const Buffet *buf;
+} SortEntry;
+
+#define SORT_SMALL 32               // insertion sort below
+#define SORT_MAXDEPTH 128           // bytes refined by key, qsort beyond
+#define SORT_PAR_MIN (64*1024)      // bft_par_sort() sequential below
+#define SORT_PAR_BLOCK (16*1024)    // entries per histogram block
+
+// Key of the 8 bytes at `off`, zero-padded.
+static inline uint64_t
+sort_key (const Buffet *buf, size_t off)
+{
+    const Tag tag = TAG(buf);
+    const size_t len = getlen(buf, tag);
+    uint64_t key = 0;
+    if (off < len) memcpy(&key, getdata(buf, tag) + off, len-off < 8 ? len-off : 8);
+    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    key = __builtin_bswap64(key);
+    #endif
+    return key;
+}
+
+static inline int
+entry_cmp (const SortEntry *a, const SortEntry *b)
+{
+    if (a->key != b->key) return a->key < b->key ? -1 : 1;
+    return bft_cmp(a->buf, b->buf);
+}
+
+static int
+entry_qcmp (const void *a, const void *b) {
+    return entry_cmp(a, b);
+}
+
+static void
+insertion_sort (SortEntry *e, size_t n)
+{
+    for (size_t i = 1; i < n; ++i) {
+        const SortEntry cur = e[i];
+        size_t j = i;
+        for (; j && entry_cmp(&cur, &e[j-1]) < 0; --j) e[j] = e[j-1];
+        e[j] = cur;
+    }
+}
+
+static void sort_ties (SortEntry *e, SortEntry *tmp, size_t n, size_t depth);
+
+// Sort `n` entries sharing their first `depth` bytes, keyed at `depth`, 
+// with `tmp` as scratch : LSD radix skipping bytes where all keys agree, 
+// then runs of equal keys.
+static void
+sort_entries (SortEntry *e, SortEntry *tmp, size_t n, size_t depth)
+{
+    if (n < SORT_SMALL) {
+        insertion_sort(e, n);
+        return;
+    }
+
+    size_t hist[8][256] = {{0}};
+    for (size_t i = 0; i < n; ++i) {
+        const uint64_t k = e[i].key;
+        for (int b = 0; b < 8; ++b) ++hist[b][k >> 8*b & 255];
+    }
+
+    SortEntry *src = e, *dst = tmp;
+    for (int b = 0; b < 8; ++b) {
+        size_t *h = hist[b];
+        if (h[src[0].key >> 8*b & 255] == n) continue;
+
+        size_t off = 0;
+        for (int d = 0; d < 256; ++d) {
+            const size_t c = h[d];
+            h[d] = off;
+            off += c;
+        }
+        for (size_t i = 0; i < n; ++i) dst[h[src[i].key >> 8*b & 255]++] = src[i];
+
+        SortEntry *t = src; src = dst; dst = t;
+    }
+    if (src != e) memcpy(e, src, n * sizeof(SortEntry));
+
+    for (size_t i = 0; i < n; ) {
+        size_t j = i+1;
+        while (j < n && e[j].key == e[i].key) ++j;
+        if (j-i >= SORT_SMALL) sort_ties(e+i, tmp+i, j-i, depth);
+        else if (j-i > 1) insertion_sort(e+i, j-i);
+        i = j;
+    }
+}
+
+// Sort `n` entries of equal key at `depth`.
+// Those ending within the key are prefixes of the others, so come first. 
+// The others share `depth`+8 bytes and sort on their next key.
+static void
+sort_ties (SortEntry *e, SortEntry *tmp, size_t n, size_t depth)
+{
+    const size_t next = depth + 8;
+    if (next > SORT_MAXDEPTH) {
+        qsort(e, n, sizeof(SortEntry), entry_qcmp);
+        return;
+    }
+
+    size_t nshort = 0;
+    for (size_t i = 0; i < n; ++i) nshort += getlen(e[i].buf, TAG(e[i].buf)) < next;
+
+    size_t s = 0, l = nshort;
+    for (size_t i = 0; i < n; ++i) {
+        const Buffet *buf = e[i].buf;
+        if (getlen(buf, TAG(buf)) < next) tmp[s++] = e[i];
+        else tmp[l++] = (SortEntry){sort_key(buf, next), buf};
+    }
+    memcpy(e, tmp, n * sizeof(SortEntry));
+
+    if (nshort > 1) qsort(e, nshort, sizeof(SortEntry), entry_qcmp);
+    sort_entries(e + nshort, tmp + nshort, n - nshort, next);
+}
+
+typedef struct {
+    Buffet *parts;
+    Buffet *out;
+    SortEntry *e, *tmp;
+    size_t (*hist)[256];    // per block, then bucket offsets
+    size_t *bucket;         // bucket starts, 257
+    int shift;              // bucket = byte at key << shift
+} SortJob;
+
+static void
+sort_keys_run (void *job, size_t beg, size_t end)
+{
+    SortJob *j = job;
+    for (size_t i = beg; i < end; ++i) 
+        j->e[i] = (SortEntry){sort_key(&j->parts[i], 0), &j->parts[i]};
+}
+
+static void
+sort_hist_run (void *job, size_t beg, size_t end)
+{
+    SortJob *j = job;
+    size_t *h = j->hist[beg / SORT_PAR_BLOCK];
+    for (size_t i = beg; i < end; ++i) ++h[j->e[i].key << j->shift >> 56];
+}
+
+static void
+sort_scatter_run (void *job, size_t beg, size_t end)
+{
+    SortJob *j = job;
+    size_t *h = j->hist[beg / SORT_PAR_BLOCK];
+    for (size_t i = beg; i < end; ++i) 
+        j->tmp[h[j->e[i].key << j->shift >> 56]++] = j->e[i];
+}
+
+static void
+sort_bucket_run (void *job, size_t beg, size_t end)
+{
+    SortJob *j = job;
+    for (size_t b = beg; b < end; ++b) {
+        const size_t lo = j->bucket[b], hi = j->bucket[b+1];
+        sort_entries(j->tmp + lo, j->e + lo, hi - lo, 0);
+    }
+}
+
+static void
+sort_gather_run (void *job, size_t beg, size_t end)
+{
+    SortJob *j = job;
+    for (size_t i = beg; i < end; ++i) j->out[i] = *j->e[i].buf;
+}
+
+static void
+sort_copy_run (void *job, size_t beg, size_t end)
+{
+    SortJob *j = job;
+    memcpy(j->parts + beg, j->out + beg, (end-beg) * sizeof(Buffet));
+}
+
+// Sort `parts`, in parallel if `par`.
+// In parallel, entries are first spread by a byte past their common 
+// prefix into 256 buckets, by stable blocks, then buckets are sorted 
+// concurrently.
+static bool
+sort_parts (Buffet *parts, int cnt, bool par)
+{
+    if (cnt < 2) return true;
+    const size_t n = cnt;
+    par &= n >= SORT_PAR_MIN;
+
+    SortJob job = {.parts = parts};
+    job.e = malloc(2 * n * sizeof(SortEntry));
+    job.out = malloc(n * sizeof(Buffet));
+    if (!job.e || !job.out) {ERR_ALLOC; goto fail;}
+    job.tmp = job.e + n;
+
+    if (par) par_run(sort_keys_run, &job, n);
+    else sort_keys_run(&job, 0, n);
+
+    uint64_t diff = 0;
+    if (par) for (size_t i = 1; i < n; ++i) diff |= job.e[i].key ^ job.e[0].key;
+
+    if (!par || !diff) {
+        sort_entries(job.e, job.tmp, n, 0);
+    } else {
+        const size_t nblocks = (n + SORT_PAR_BLOCK-1) / SORT_PAR_BLOCK;
+        size_t bucket[257];
+        job.shift = __builtin_clzll(diff);
+        if (job.shift > 56) job.shift = 56;
+        job.hist = calloc(nblocks, sizeof(*job.hist));
+        job.bucket = bucket;
+        if (!job.hist) {ERR_ALLOC; goto fail;}
+
+        par_run_by(sort_hist_run, &job, n, SORT_PAR_BLOCK);
+
+        // offsets by bucket, then block : scatter stays stable
+        size_t off = 0;
+        for (int d = 0; d < 256; ++d) {
+            bucket[d] = off;
+            for (size_t k = 0; k < nblocks; ++k) {
+                const size_t c = job.hist[k][d];
+                job.hist[k][d] = off;
+                off += c;
+            }
+        }
+        bucket[256] = n;
+
+        par_run_by(sort_scatter_run, &job, n, SORT_PAR_BLOCK);
+        par_run_by(sort_bucket_run, &job, 256, 1);
+        free(job.hist);
+
+        // sorted in tmp
+        SortEntry *t = job.e; job.e = job.tmp; job.tmp = t;
+    }
+
+    if (par) {
+        par_run(sort_gather_run, &job, n);
+        par_run(sort_copy_run, &job, n);
+    } else {
+        sort_gather_run(&job, 0, n);
+        sort_copy_run(&job, 0, n);
+    }
+
+    free(job.e < job.tmp ? job.e : job.tmp);
+    free(job.out);
+    return true;
+
+    fail:
+    free(job.e);
+    free(job.out);
+    return false;
+}
+
+/**
+ * Sort a list of Buffets in place, in bft_cmp() order.
+ * Each Buffet's data is read once for an 8-byte prefix key, then 
+ * (key, pointer) entries are radix sorted. Runs of equal keys are 
+ * refined on their next 8 bytes, full compares are left for deep ties.
+ * 
+ * @param[in,out] parts the Buffet array
+ * @param[in] cnt the array length
+ * @return false on allocation failure, `parts` unchanged
+ */
+bool
+bft_sort (Buffet *parts, int cnt)
+{
+    return sort_parts(parts, cnt, false);
+}
+
+/**
+ * Sort a list of Buffets like bft_sort(), spread over the parallel pool.
+ * 
+ * @param[in,out] parts the Buffet array
+ * @param[in] cnt the array length
+ * @return false on allocation failure, `parts` unchanged
+ */
+bool
+bft_par_sort (Buffet *parts, int cnt)
+{
+    return sort_parts(parts, cnt, true);
+}
+
+/**
+ * Sort a list of Buffets like bft_sort(), then drop duplicates.
+ * Duplicates are freed, the first of each kept at the front.
+ * Slots past the returned count are left empty.
+ * 
+ * @param[in,out] parts the Buffet array
+ * @param[in] cnt the array length
+ * @return the number of distinct Buffets, -1 on allocation failure
+ */
+int
+bft_sort_unique (Buffet *parts, int cnt)
+{
+    if (cnt < 2) return cnt > 0 ? cnt : 0;
+    if (!sort_parts(parts, cnt, cnt >= SORT_PAR_MIN)) return -1;
+
+    int w = 1;
+    for (int i = 1; i < cnt; ++i) {
+        if (bft_eq(&parts[i], &parts[w-1])) bft_free(&parts[i]);
+        else {
+            parts[w] = parts[i];
+            if (i != w) parts[i] = ZERO;
+            ++w;
+        }
+    }
+    return w;
+}
+
+
+//============================================================================
+// Map
+//============================================================================
+
+// Swiss table : a control byte per slot tells empty, deleted, or full 
+// with 7 bits of the key hash, and is probed 16 at a time. 
+// The first MAP_GROUP-1 control bytes are mirrored past the end 
+// so that a group load never wraps.
+
+struct BuffetMapSlot {
+    Buffet key;
+    void *val;
+};
+
+typedef struct BuffetMapSlot Slot;
+
+#define MAP_GROUP 16
+#define MAP_MINCAP 16
+#define MAP_EMPTY 0x80
+#define MAP_DELETED 0xfe    // tombstone, keeps probe chains going
+#define MAP_H2(h) ((uint8_t)((h) & 0x7f))
+#define MAP_MAXLOAD(cap) ((cap) - (cap)/8)
+
+// Bit i set for each control byte i of the group equal to `c`.
+static inline uint32_t
+group_match (const uint8_t *ctrl, uint8_t c)
+{
+    #ifdef SIMD_X86
+    const __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c)));
+    #else
+    uint32_t m = 0;
+    for (int i = 0; i < MAP_GROUP; ++i) m |= (uint32_t)(ctrl[i] == c) << i;
+    return m;
+    #endif
+}
+
+// Bit i set for each empty or deleted control byte : high bit set.
+static inline uint32_t
+group_free (const uint8_t *ctrl)
+{
+    #ifdef SIMD_X86
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+    #else
+    uint32_t m = 0;
+    for (int i = 0; i < MAP_GROUP; ++i) m |= (uint32_t)(ctrl[i] >> 7) << i;
+    return m;
+    #endif
+}
+
+static inline void
+set_ctrl (BuffetMap *map, size_t i, uint8_t c)
+{
+    map->ctrl[i] = c;
+    if (i < MAP_GROUP-1) map->ctrl[map->cap + i] = c;
+}
+
+// Slot of key `data`, or -1.
+// Probes groups at triangular offsets, up to the first group with an empty.
+static ptrdiff_t
+map_find (const BuffetMap *map, const char *data, size_t len, uint64_t h)
+{
+    if (!map->cap) return -1;
+
+    const size_t mask = map->cap - 1;
+    const uint8_t h2 = MAP_H2(h);
+    size_t pos = (h >> 7) & mask;
+
+    for (size_t step = MAP_GROUP;; step += MAP_GROUP) {
+
+        const uint8_t *group = map->ctrl + pos;
+
+        for (uint32_t m = group_match(group, h2); m; m &= m-1) {
+            const size_t i = (pos + __builtin_ctz(m)) & mask;
+            const Buffet *key = &map->slots[i].key;
+            const Tag tag = TAG(key);
+            if (getlen(key, tag) == len 
+            && eq_bytes(getdata(key, tag), data, len)) return i;
+        }
+
+        if (group_match(group, MAP_EMPTY)) return -1;
+        pos = (pos + step) & mask;
+    }
+}
+
+// First empty or deleted slot on the probe sequence of `h`.
+static size_t
+map_free_slot (const BuffetMap *map, uint64_t h)
+{
+    const size_t mask = map->cap - 1;
+    size_t pos = (h >> 7) & mask;
+
+    for (size_t step = MAP_GROUP;; step += MAP_GROUP) {
+        const uint32_t m = group_free(map->ctrl + pos);
+        if (m) return (pos + __builtin_ctz(m)) & mask;
+        pos = (pos + step) & mask;
+    }
+}
+
+// Move all keys to a table of `cap` slots, dropping tombstones.
+static bool
+map_rehash (BuffetMap *map, size_t cap)
+{
+    const size_t ctrlsz = cap + MAP_GROUP-1;
+    Slot *slots = malloc(cap * sizeof(Slot) + ctrlsz);
+    if (!slots) {ERR_ALLOC; return false;}
+
+    BuffetMap fresh = {
+        .slots = slots,
+        .ctrl = (uint8_t*)(slots + cap),
+        .cap = cap,
+        .cnt = map->cnt,
+        .growth = MAP_MAXLOAD(cap) - map->cnt
+    };
+    memset(fresh.ctrl, MAP_EMPTY, ctrlsz);
+
+    for (size_t i = 0; i < map->cap; ++i) {
+        if (map->ctrl[i] & 0x80) continue;
+        const uint64_t h = bft_hash(&map->slots[i].key);
+        const size_t j = map_free_slot(&fresh, h);
+        set_ctrl(&fresh, j, MAP_H2(h));
+        fresh.slots[j] = map->slots[i];
+    }
+
+    free(map->slots);
+    *map = fresh;
+
+    return true;
+}
+
+/**
+ * Map a key to a value, replacing any previous value.
+ * SSO keys are stored inline, OWN keys share their store (bft_dup), 
+ * views are copied.
+ * 
+ * @param[in,out] map the map, possibly BUFFET_MAP_ZERO
+ * @param[in] key the key
+ * @param[in] val the value
+ * @return false on allocation failure
+ */
+bool
+bft_map_put (BuffetMap *map, const Buffet *key, void *val)
+{
+    const Tag tag = TAG(key);
+    const char *data = getdata(key, tag);
+    const size_t len = getlen(key, tag);
+    const uint64_t h = bft_hash(key);
+
+    const ptrdiff_t found = map_find(map, data, len, h);
+    if (found >= 0) {
+        map->slots[found].val = val;
+        return true;
+    }
+
+    if (!map->growth) {
+        // purge tombstones if they take the room, else grow
+        const size_t cap = !map->cap ? MAP_MINCAP 
+            : map->cnt < MAP_MAXLOAD(map->cap)/2 ? map->cap : 2*map->cap;
+        if (!map_rehash(map, cap)) return false;
+    }
+
+    Buffet own = (tag==SSO || tag==OWN) ? bft_dup(key) : bft_copyall(key);
+    if (getlen(&own, TAG(&own)) != len) return false;
+
+    const size_t i = map_free_slot(map, h);
+    if (map->ctrl[i] == MAP_EMPTY) -- map->growth;
+    set_ctrl(map, i, MAP_H2(h));
+    map->slots[i] = (Slot){own, val};
+    ++ map->cnt;
+
+    return true;
+}
+
+/**
+ * Look up a key.
+ * 
+ * @param[in] map the map
+ * @param[in] key the key
+ * @return address of the value, or NULL if absent
+ */
+void**
+bft_map_get (const BuffetMap *map, const Buffet *key)
+{
+    const Tag tag = TAG(key);
+    const ptrdiff_t i = map_find(map, getdata(key, tag), getlen(key, tag), 
+        bft_hash(key));
+    return i < 0 ? NULL : &map->slots[i].val;
+}
+
+/**
+ * Look up a key given as a byte array, without building a Buffet.
+ * 
+ * @param[in] map the map
+ * @param[in] key the key bytes
+ * @param[in] len the key length
+ * @return address of the value, or NULL if absent
+ */
+void**
+bft_map_getmem (const BuffetMap *map, const char *key, size_t len)
+{
+    const ptrdiff_t i = map_find(map, key, len, hash_bytes(key, len));
+    return i < 0 ? NULL : &map->slots[i].val;
+}
+
+/**
+ * Remove a key, releasing the map's copy or share of it.
+ * 
+ * @param[in,out] map the map
+ * @param[in] key the key
+ * @return false if absent
+ */
+bool
+bft_map_del (BuffetMap *map, const Buffet *key)
+{
+    const Tag tag = TAG(key);
+    const ptrdiff_t i = map_find(map, getdata(key, tag), getlen(key, tag), 
+        bft_hash(key));
+    if (i < 0) return false;
+
+    bft_free(&map->slots[i].key);
+    set_ctrl(map, i, MAP_DELETED);
+    -- map->cnt;
+
+    return true;
+}
+
+/**
+ * Iterate over a map's entries, in no particular order.
+ * The map must not change during the iteration.
+ * 
+ * @param[in] map the map
+ * @param[in,out] pos iteration state, to start at 0
+ * @param[out] key the entry key, if not NULL
+ * @param[out] val the entry value, if not NULL
+ * @return false when done
+ */
+bool
+bft_map_next (const BuffetMap *map, size_t *pos, const Buffet **key, 
+    void **val)
+{
+    for (size_t i = *pos; i < map->cap; ++i) {
+        if (map->ctrl[i] & 0x80) continue;
+        *pos = i+1;
+        if (key) *key = &map->slots[i].key;
+        if (val) *val = map->slots[i].val;
+        return true;
+    }
+
+    *pos = map->cap;
+    return false;
+}
+
+/**
+ * Release a map's keys and memory. Values are the caller's.
+ * 
+ * @param[in,out] map the map, left empty
+ */
+void
+bft_map_free (BuffetMap *map)
+{
+    for (size_t i = 0; i < map->cap; ++i) 
+        if (!(map->ctrl[i] & 0x80)) bft_free(&map->slots[i].key);
+
+    free(map->slots);
+    *map = BUFFET_MAP_ZERO;
 }
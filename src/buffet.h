@@ -9,13 +9,25 @@ Copyright (C) 2022 - Francois Alcover <francois|at|alcover|dot|fr>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdarg.h>
 #include <assert.h>
+#include <sys/types.h>
 
 // max stack allocation for split()
 #ifndef BUFFET_STACK_MEM
 #define BUFFET_STACK_MEM 1024
 #endif
 
+// parallel ops: buffets per work block (~ L1 cache)
+#ifndef BUFFET_PAR_BLOCK
+#define BUFFET_PAR_BLOCK 1024
+#endif
+
+// list length from which join() goes parallel
+#ifndef BUFFET_PAR_JOIN_MIN
+#define BUFFET_PAR_JOIN_MIN (64*1024)
+#endif
+
 #define TAGBITS 2
 
 // tag=OWN : share of heap data
@@ -47,22 +59,103 @@ static_assert (sizeof(Buffet) == sizeof(BuffetPtr),
 
 #undef TAGBITS
 
+// rope: minimum chunk capacity
+#ifndef BUFFET_ROPE_CHUNK
+#define BUFFET_ROPE_CHUNK (64*1024)
+#endif
+
+// reader: default chunk capacity
+#ifndef BUFFET_READER_CHUNK
+#define BUFFET_READER_CHUNK (64*1024)
+#endif
+
+// bft_mapfile() access hints
+#define BUFFET_MAP_SEQUENTIAL 1
+#define BUFFET_MAP_WILLNEED   2
+// bft_mapfile() : keep the file open for bft_sendfile()
+#define BUFFET_MAP_KEEPFD     4
+
+// Rope : chain of refcounted chunks
+typedef struct BuffetRope {
+    struct BuffetNode *head, *tail;
+    size_t len; // total length
+    int cnt;    // number of chunks
+} BuffetRope;
+
+// Reader : records as views into chunks read from a file descriptor
+typedef struct {
+    Buffet chunk;   // current chunk, co-owned by the records
+    size_t pos;     // start of next record in chunk
+    size_t scan;    // where to resume separator search
+    size_t chunksz;
+    int fd;
+    int err;        // errno of a failed read or allocation, 0 on clean end
+    bool eof;
+} BuffetReader;
+
+// Tokenizer : lazy split of a Buffet on runs of whitespace
+typedef struct {
+    Buffet *src;
+    size_t pos;     // where to resume
+    size_t blk;     // offset of the cached block
+    uint64_t tok;   // token bytes of the cached block
+} BuffetTokenizer;
+
+// Map : Swiss table from Buffet keys to pointers
+typedef struct {
+    struct BuffetMapSlot *slots;
+    uint8_t *ctrl;  // control bytes
+    size_t cap;     // slots, power of 2
+    size_t cnt;     // keys
+    size_t growth;  // insertions left before rehash
+} BuffetMap;
+
+// Template : literal segments and named slots, compiled once
+typedef struct {
+    char *text;                     // literals, then slot names
+    struct BuffetTplPart *parts;    // literal then slot, in order
+    int cnt;        // parts
+    int slots;      // distinct slot names
+    size_t fixed;   // literal bytes per render
+} BuffetTemplate;
+
 #define BUFFET_ZERO ((Buffet){.fill={0}})
+#define BUFFET_ROPE_ZERO ((BuffetRope){0})
+#define BUFFET_MAP_ZERO ((BuffetMap){0})
+#define BUFFET_TEMPLATE_ZERO ((BuffetTemplate){0})
 #define BUFFET_SSOMAX (sizeof(((BuffetSSO){0}).data)-1)
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct iovec;
+
 Buffet  bft_new (size_t cap);
 Buffet  bft_memcopy (const char *src, size_t len);
 Buffet  bft_memview (const char *src, size_t len);
+Buffet  bft_mapfile (const char *path, int advice);
 Buffet  bft_dup  (const Buffet *src);
 Buffet  bft_copy (const Buffet *src, size_t off, size_t len);
 Buffet  bft_copyall (const Buffet *src);
 Buffet  bft_view (Buffet *src, size_t off, size_t len);
 size_t  bft_cat (Buffet *dst, const Buffet *buf, const char *src, size_t len);
 size_t  bft_append (Buffet *buf, const char *src, size_t len);
+size_t  bft_append_u64 (Buffet *buf, uint64_t val);
+size_t  bft_append_i64 (Buffet *buf, int64_t val);
+size_t  bft_append_hex (Buffet *buf, uint64_t val);
+size_t  bft_append_double (Buffet *buf, double val);
+size_t  bft_appendf (Buffet *buf, const char *fmt, ...);
+size_t  bft_vappendf (Buffet *buf, const char *fmt, va_list args);
+bool    bft_to_u64 (const Buffet *buf, uint64_t *out);
+bool    bft_to_i64 (const Buffet *buf, int64_t *out);
+bool    bft_to_double (const Buffet *buf, double *out);
+int     bft_to_double_many (const Buffet *parts, int cnt, double *out);
+int     bft_to_i64_many (const Buffet *parts, int cnt, int64_t *out);
+size_t  bft_consume (Buffet *buf, size_t n);
+ssize_t bft_read_fd (Buffet *buf, int fd, size_t maxlen);
+ssize_t bft_pread (Buffet *buf, int fd, size_t maxlen, off_t off);
+ssize_t bft_recv (Buffet *buf, int sockfd, size_t maxlen, int flags);
 void    bft_free (Buffet *buf);
 
 Buffet  bft_join (const Buffet *list, int cnt, 
@@ -71,7 +164,72 @@ Buffet* bft_split (const char* src, size_t srclen,
                    const char* sep, size_t seplen, int *outcnt);
 Buffet* bft_splitstr (const char *src, const char *sep, int *outcnt);
 
+void    bft_par_for (Buffet *parts, int cnt, 
+                     void (*fun)(Buffet *part, void *arg), void *arg);
+void    bft_par_map (const Buffet *parts, int cnt, void *out, size_t outsize,
+                     void (*fun)(const Buffet *part, void *out, void *arg), 
+                     void *arg);
+Buffet  bft_par_join (const Buffet *parts, int cnt, 
+                      const char* sep, size_t seplen);
+
+int     bft_save (const char *path, const Buffet *parts, int cnt);
+Buffet* bft_load (const char *path, int *outcnt, Buffet *owner);
+Buffet* bft_load_files (const char *const *paths, int cnt);
+
+size_t  bft_to_iovec (const Buffet *parts, int cnt, struct iovec *iov);
+ssize_t bft_writev (int fd, const Buffet *parts, int cnt);
+
+ssize_t bft_vmsplice (int pipefd, const Buffet *buf, Buffet *pin);
+ssize_t bft_splice (int fd, const Buffet *buf, Buffet *pin);
+ssize_t bft_sendfile (int fd, const Buffet *buf);
+
 int     bft_cmp (const Buffet *a, const Buffet *b);
+bool    bft_eq (const Buffet *a, const Buffet *b);
+uint64_t bft_hash (const Buffet *buf);
+void    bft_hash_many (const Buffet *parts, int cnt, uint64_t *out);
+bool    bft_sort (Buffet *parts, int cnt);
+bool    bft_par_sort (Buffet *parts, int cnt);
+int     bft_sort_unique (Buffet *parts, int cnt);
+
+bool    bft_lower (Buffet *buf);
+bool    bft_upper (Buffet *buf);
+int     bft_casecmp (const Buffet *a, const Buffet *b);
+Buffet  bft_trim (Buffet *buf);
+Buffet  bft_ltrim (Buffet *buf);
+Buffet  bft_rtrim (Buffet *buf);
+Buffet* bft_tokenize_ws (Buffet *src, int *outcnt);
+BuffetTokenizer 
+        bft_tokenizer (Buffet *src);
+bool    bft_next_token (BuffetTokenizer *tk, Buffet *tok);
+size_t  bft_replace (Buffet *buf, const char *needle, size_t nlen, 
+                     const char *repl, size_t rlen);
+size_t  bft_replace_many (Buffet *buf, const Buffet *table, int cnt);
+
+Buffet  bft_base64_encode (const Buffet *src);
+bool    bft_base64_decode (Buffet *buf);
+Buffet  bft_hex_encode (const Buffet *src);
+bool    bft_hex_decode (Buffet *buf);
+
+Buffet  bft_json_escape (const Buffet *src);
+bool    bft_json_unescape (const Buffet *src, Buffet *out);
+
+bool    bft_utf8_valid (const Buffet *buf);
+size_t  bft_utf8_len (const Buffet *buf);
+Buffet  bft_utf8_view (Buffet *buf, size_t off, size_t cnt);
+
+bool    bft_map_put (BuffetMap *map, const Buffet *key, void *val);
+void**  bft_map_get (const BuffetMap *map, const Buffet *key);
+void**  bft_map_getmem (const BuffetMap *map, const char *key, size_t len);
+bool    bft_map_del (BuffetMap *map, const Buffet *key);
+bool    bft_map_next (const BuffetMap *map, size_t *pos, 
+                      const Buffet **key, void **val);
+void    bft_map_free (BuffetMap *map);
+BuffetTemplate 
+        bft_template (const char *pattern);
+int     bft_template_slot (const BuffetTemplate *tpl, const char *name);
+Buffet  bft_render (const BuffetTemplate *tpl, const Buffet *args);
+void    bft_template_free (BuffetTemplate *tpl);
+
 size_t  bft_cap (const Buffet *buf);
 size_t  bft_len (const Buffet *buf);
 
@@ -81,6 +239,24 @@ const char*
         bft_cstr (const Buffet *buf, bool *mustfree);
 char*   bft_export (const Buffet *buf);
 
+size_t  bft_rope_append (BuffetRope *rope, const char *src, size_t len);
+size_t  bft_rope_insert (BuffetRope *rope, size_t off, 
+                         const char *src, size_t len);
+size_t  bft_rope_splice (BuffetRope *rope, size_t off, const Buffet *buf);
+BuffetRope 
+        bft_rope_view (const BuffetRope *rope, size_t off, size_t len);
+Buffet  bft_rope_flatten (BuffetRope *rope);
+int     bft_rope_iovec (const BuffetRope *rope, struct iovec *iov, int max);
+ssize_t bft_rope_writev (int fd, const BuffetRope *rope);
+void    bft_rope_free (BuffetRope *rope);
+
+BuffetReader 
+        bft_reader (int fd, size_t chunksz);
+bool    bft_read_record (BuffetReader *rd, const char *sep, size_t seplen, 
+                         Buffet *out);
+bool    bft_readline (BuffetReader *rd, Buffet *line);
+void    bft_reader_free (BuffetReader *rd);
+
 void    bft_print (const Buffet *buf);
 void    bft_dbg (const Buffet *buf);
 
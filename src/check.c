@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #ifdef NDEBUG
 #undef NDEBUG
 #endif
@@ -5,7 +6,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <wchar.h>
+#include <errno.h>
 #include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "buffet.h"
 #include "log.h"
 #include "util.h"
@@ -159,7 +170,7 @@ void memview()
     bft_free(&src); \
 }
 
-void dup()
+void dup_()
 {
     dup_new(0);
     dup_new(8);
@@ -673,6 +684,2056 @@ void cmp()
     // todo other combins
 }
 
+// bft_eq against memcmp, equal then with one differing byte
+static void ueq (Buffet *a, Buffet *b) {
+    const size_t len = bft_len(a);
+    char *data = (char*)bft_data(b);
+    assert (bft_eq(a, b));
+    assert (bft_eq(b, a));
+    for (size_t i = 0; i < len; ++i) {
+        data[i] ^= 1;
+        assert (!bft_eq(a, b));
+        data[i] ^= 1;
+    }
+    assert (bft_eq(a, b));
+}
+
+void eq()
+{
+    const size_t lens[] = {1024, 1025, 4096};
+    char *src = repeat(ALPHA64, 4097);
+
+    for (size_t k = 0; k < 300 + 3; ++k) {
+        const size_t len = k < 300 ? k : lens[k-300];
+        Buffet own = bft_memcopy(src, len);
+        Buffet cpy = bft_memcopy(src, len);
+        Buffet vue = bft_memview(src, len);
+        ueq(&own, &cpy);
+        ueq(&cpy, &vue);
+        // length first
+        Buffet more = bft_memcopy(src, len+1);
+        assert (!bft_eq(&own, &more));
+        bft_free(&more);
+        bft_free(&own);
+        bft_free(&cpy);
+    }
+
+    // SSO bytes after len are ignored
+    for (size_t len = 0; len < BUFFET_SSOMAX; ++len) {
+        Buffet a = bft_memcopy(alpha, len);
+        Buffet b = bft_memcopy(alpha, BUFFET_SSOMAX);
+        b.sso.len = len;
+        ueq(&a, &b);
+    }
+
+    // length overflowing an int
+    Buffet big = bft_memview(alpha, (size_t)1 << 40);
+    Buffet one = bft_memview(alpha, 1);
+    assert_int (bft_cmp(&big, &one), 1);
+    assert_int (bft_cmp(&one, &big), -1);
+    assert (!bft_eq(&big, &one));
+
+    free(src);
+}
+
+//=============================================================================
+
+void lowerupper()
+{
+    char src[1100], low[1100], up[1100];
+    for (int i = 0; i < 1100; ++i) {
+        src[i] = (char)(i*37 + i/256);
+        low[i] = tolower((unsigned char)src[i]);
+        up[i] = toupper((unsigned char)src[i]);
+    }
+
+    for (size_t len = 0; len < 1100; len += (len < 100 ? 1 : 333)) {
+        // in place : SSO, sole owner
+        Buffet own = bft_memcopy(src, len);
+        const char *data = bft_data(&own);
+        assert (bft_lower(&own));
+        assert (bft_data(&own) == data);
+        assert (!memcmp(bft_data(&own), low, len));
+        assert (bft_upper(&own));
+        assert (!memcmp(bft_data(&own), up, len));
+
+        // copy : co-owner and view targets untouched
+        Buffet dup = bft_dup(&own);
+        assert (bft_lower(&dup));
+        assert (!memcmp(bft_data(&dup), low, len));
+        assert (!memcmp(bft_data(&own), up, len));
+
+        Buffet vue = bft_memview(src, len);
+        assert (bft_upper(&vue));
+        assert (!memcmp(bft_data(&vue), up, len));
+        assert_int (bft_len(&vue), len);
+
+        // casecmp
+        Buffet l = bft_memview(low, len);
+        Buffet u = bft_memview(up, len);
+        assert_int (bft_casecmp(&l, &u), 0);
+        assert_int (bft_casecmp(&own, &dup), 0);
+        if (len) {
+            Buffet shorter = bft_memview(up, len-1);
+            assert_int (bft_casecmp(&l, &shorter), 1);
+            assert_int (bft_casecmp(&shorter, &l), -1);
+        }
+
+        bft_free(&vue);
+        bft_free(&dup);
+        bft_free(&own);
+    }
+    for (int i = 0; i < 1100; ++i) 
+        assert (src[i] == (char)(i*37 + i/256));
+
+    // casecmp order : first difference, lowered
+    Buffet a = bft_memview("Hello World, Hello World, Hello!", 32);
+    Buffet b = bft_memview("hello world, hello world, hello?", 32);
+    assert (bft_casecmp(&a, &b) < 0);
+    assert (bft_casecmp(&b, &a) > 0);
+    Buffet c = bft_memview("HELLO_", 6);
+    Buffet d = bft_memview("hello ", 6);
+    assert (bft_casecmp(&c, &d) > 0);
+
+    // SSO with views : refused
+    Buffet sso = bft_memcopy("Abc", 3);
+    Buffet ssv = bft_view(&sso, 0, 2);
+    assert (!bft_lower(&sso));
+    assert_str (bft_data(&sso), "Abc");
+    bft_free(&ssv);
+    assert (bft_lower(&sso));
+    assert_str (bft_data(&sso), "abc");
+}
+
+void trim()
+{
+    const char *text = " \t\n" ALPHA64 " x \r\v\f ";
+    const size_t len = strlen(text);
+
+    Buffet own = bft_memcopy(text, len);
+    Buffet t = bft_trim(&own);
+    assert_int (bft_len(&t), 64 + 2);
+    assert (bft_data(&t) == bft_data(&own) + 3);
+    assert_stn (bft_data(&t), ALPHA64 " x", 66);
+
+    Buffet vue = bft_memview(text, len);
+    Buffet tv = bft_trim(&vue);
+    assert (bft_data(&tv) == text + 3);
+    assert_int (bft_len(&tv), 66);
+
+    Buffet sso = bft_memcopy("  ab c\n", 7);
+    Buffet ts = bft_trim(&sso);
+    assert_int (bft_len(&ts), 4);
+    assert_stn (bft_data(&ts), "ab c", 4);
+
+    Buffet blank = bft_memview(" \t \n", 4);
+    Buffet tb = bft_trim(&blank);
+    check_zero(&tb);
+    Buffet none = BUFFET_ZERO;
+    Buffet tn = bft_trim(&none);
+    check_zero(&tn);
+
+    Buffet tl = bft_ltrim(&own);
+    assert_int (bft_len(&tl), len-3);
+    Buffet tr = bft_rtrim(&own);
+    assert_int (bft_len(&tr), len-5);
+    assert (bft_data(&tr) == bft_data(&own));
+    Buffet trb = bft_rtrim(&blank);
+    check_zero(&trb);
+
+    bft_free(&tr);
+    bft_free(&tl);
+    bft_free(&ts);
+    bft_free(&sso);
+    bft_free(&t);
+    bft_free(&own);
+}
+
+void tokenize()
+{
+    char src[300+140];
+    const char *words[] = {"a", "bc", "token", ALPHA64 ALPHA64, "x\x80y"};
+    const char *spaces[] = {" ", "\t", "  \n ", "\r\v\f"};
+    uint32_t seed = 5;
+    #define RAND() (seed = seed*1103515245 + 12345, seed >> 8)
+
+    for (int round = 0; round < 3000; ++round) {
+        // random words separated by whitespace runs, lengths across blocks
+        size_t len = 0;
+        int cnt = 0;
+        size_t offs[200], lens[200];
+        const size_t target = RAND() % 300;
+        if (RAND() % 2) len += sprintf(src, "%s", spaces[RAND() % 4]);
+        while (len < target) {
+            const char *w = words[RAND() % 5];
+            offs[cnt] = len;
+            lens[cnt++] = strlen(w);
+            len += sprintf(src+len, "%s%s", w, spaces[RAND() % 4]);
+        }
+        if (cnt && RAND() % 2) len -= strspn(src + offs[cnt-1] + lens[cnt-1], 
+            " \t\n\r\v\f");
+
+        Buffet buf = round % 3 ? bft_memcopy(src, len) : bft_memview(src, len);
+
+        int outcnt;
+        Buffet *toks = bft_tokenize_ws(&buf, &outcnt);
+        assert_int (outcnt, cnt);
+        assert (cnt || !toks);
+
+        BuffetTokenizer tk = bft_tokenizer(&buf);
+        Buffet tok;
+        for (int i = 0; i < cnt; ++i) {
+            assert_int (bft_len(&toks[i]), lens[i]);
+            assert (bft_data(&toks[i]) == bft_data(&buf) + offs[i]);
+            assert (bft_next_token(&tk, &tok));
+            assert (bft_data(&tok) == bft_data(&toks[i]));
+            assert_int (bft_len(&tok), lens[i]);
+            bft_free(&tok);
+            bft_free(&toks[i]);
+        }
+        assert (!bft_next_token(&tk, &tok));
+        free(toks);
+
+        // trims agree with the tokens
+        Buffet t = bft_trim(&buf);
+        Buffet l = bft_ltrim(&buf);
+        Buffet r = bft_rtrim(&buf);
+        if (cnt) {
+            const size_t end = offs[cnt-1] + lens[cnt-1];
+            assert (bft_data(&t) == bft_data(&buf) + offs[0]);
+            assert_int (bft_len(&t), end - offs[0]);
+            assert_int (bft_len(&l), len - offs[0]);
+            assert_int (bft_len(&r), end);
+        } else {
+            check_zero(&t);
+            check_zero(&l);
+            check_zero(&r);
+        }
+        bft_free(&r);
+        bft_free(&l);
+        bft_free(&t);
+        bft_free(&buf);
+    }
+
+    // SSO source : views of it
+    Buffet sso = bft_memcopy(" one two\t", 9);
+    int cnt;
+    Buffet *toks = bft_tokenize_ws(&sso, &cnt);
+    assert_int (cnt, 2);
+    assert_stn (bft_data(&toks[1]), "two", 3);
+    bft_free(&toks[0]);
+    bft_free(&toks[1]);
+    free(toks);
+    bft_free(&sso);
+    #undef RAND
+}
+
+//=============================================================================
+
+// Reference : decode code points, rejecting what Unicode forbids.
+static bool utf8_ref (const unsigned char *p, size_t len)
+{
+    for (size_t i = 0; i < len;) {
+        const unsigned c = p[i];
+        const int n = c < 0x80 ? 1 : c < 0xC0 ? 0 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : c < 0xF8 ? 4 : 0;
+        if (!n || i+n > len) return false;
+        uint32_t cp = n == 1 ? c : c & (0x7F >> n);
+        for (int k = 1; k < n; ++k) {
+            if ((p[i+k] & 0xC0) != 0x80) return false;
+            cp = cp << 6 | (p[i+k] & 0x3F);
+        }
+        const uint32_t min[] = {0, 0, 0x80, 0x800, 0x10000};
+        if (cp < min[n] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) 
+            return false;
+        i += n;
+    }
+    return true;
+}
+
+static size_t utf8_put (char *out, uint32_t cp)
+{
+    if (cp < 0x80) {out[0] = cp; return 1;}
+    if (cp < 0x800) {out[0] = 0xC0|cp>>6; out[1] = 0x80|(cp&63); return 2;}
+    if (cp < 0x10000) {
+        out[0] = 0xE0|cp>>12; out[1] = 0x80|(cp>>6&63); out[2] = 0x80|(cp&63); 
+        return 3;
+    }
+    out[0] = 0xF0|cp>>18; out[1] = 0x80|(cp>>12&63); 
+    out[2] = 0x80|(cp>>6&63); out[3] = 0x80|(cp&63);
+    return 4;
+}
+
+void utf8()
+{
+    char src[1200];
+    uint32_t seed = 1;
+    #define RAND() (seed = seed*1103515245 + 12345, seed >> 8)
+
+    const uint32_t ranges[] = {0x7F, 0x7FF, 0xD7FF, 0xFFFF, 0x10FFFF};
+
+    for (int round = 0; round < 3000; ++round) {
+        // valid text of mixed widths, mostly ASCII on some rounds
+        size_t len = 0, cps = 0;
+        const size_t target = RAND() % 1000;
+        while (len < target) {
+            const uint32_t top = ranges[RAND() % (round%3 ? 5 : 1)];
+            uint32_t cp = RAND() % (top + 1);
+            if (cp >= 0xD800 && cp <= 0xDFFF) cp = 0xE000;
+            len += utf8_put(src+len, cp);
+            ++cps;
+        }
+
+        Buffet buf = bft_memcopy(src, len);
+        assert (bft_utf8_valid(&buf));
+        assert (bft_utf8_valid(&buf)); // cached
+        assert_int (bft_utf8_len(&buf), cps);
+        Buffet co = bft_dup(&buf);
+        assert (bft_utf8_valid(&co));
+        bft_free(&co);
+
+        // view by code points
+        if (cps) {
+            const size_t off = RAND() % cps, cnt = RAND() % (cps+1);
+            Buffet vue = bft_utf8_view(&buf, off, cnt);
+            const size_t exp = cnt < cps-off ? cnt : cps-off;
+            assert_int (bft_utf8_len(&vue), exp);
+            assert (!exp || bft_utf8_valid(&vue));
+            bft_free(&vue);
+        }
+
+        // corruption, cache dropped by the write
+        if (len) {
+            char *data = (char*)bft_data(&buf);
+            const size_t at = RAND() % len;
+            const char bad[] = {0x80, 0xBF, 0xC0, 0xC1, 0xE0, 0xED, 0xF0, 0xF4, 0xF5, 0xFF, 'a'};
+            Buffet cur = bft_memcopy(data, len);
+            bft_free(&buf);
+            buf = cur;
+            data = (char*)bft_data(&buf);
+            data[at] = bad[RAND() % sizeof(bad)];
+            const bool exp = utf8_ref((const unsigned char*)data, len);
+            assert (bft_utf8_valid(&buf) == exp);
+            // truncations
+            const size_t cut = RAND() % (len+1);
+            Buffet part = bft_memview(src, cut);
+            assert (bft_utf8_valid(&part) == utf8_ref((unsigned char*)src, cut));
+        }
+
+        bft_free(&buf);
+    }
+
+    // classic cases, at various offsets for the vector path
+    const char *bad[] = {
+        "\xC0\xAF", "\xE0\x80\xAF", "\xF0\x80\x80\xAF", // overlong
+        "\xED\xA0\x80", "\xED\xBF\xBF", // surrogates
+        "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", // past U+10FFFF
+        "\x80", "\xC3", "\xE2\x82", "\xF0\x9F\x98", // lone, truncated
+        "\xC3\x28", "\xE2\x28\xA1", "\xFF"};
+    const char *good[] = {"\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", 
+        "\xED\x9F\xBF", "\xEE\x80\x80", "\xF4\x8F\xBF\xBF"};
+    for (size_t pos = 0; pos < 70; ++pos) {
+        for (size_t k = 0; k < sizeof(bad)/sizeof(*bad); ++k) {
+            memset(src, 'x', 80);
+            memcpy(src+pos, bad[k], strlen(bad[k]));
+            Buffet vue = bft_memview(src, 80);
+            assert (!bft_utf8_valid(&vue));
+            Buffet cut = bft_memview(src, pos + strlen(bad[k]));
+            assert (!bft_utf8_valid(&cut));
+        }
+        for (size_t k = 0; k < sizeof(good)/sizeof(*good); ++k) {
+            memset(src, 'x', 80);
+            memcpy(src+pos, good[k], strlen(good[k]));
+            Buffet vue = bft_memview(src, 80);
+            assert (bft_utf8_valid(&vue));
+            assert_int (bft_utf8_len(&vue), 80 - strlen(good[k]) + 1);
+        }
+    }
+
+    // cache dropped on append
+    memset(src, 'x', 40);
+    Buffet own = bft_memcopy(src, 40);
+    assert (bft_utf8_valid(&own));
+    bft_append(&own, "\xC3", 1);
+    assert (!bft_utf8_valid(&own));
+    bft_append(&own, "\xA9", 1);
+    assert (bft_utf8_valid(&own));
+    bft_free(&own);
+
+    // view on boundaries
+    Buffet s = bft_memview("a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80z", 11);
+    Buffet v = bft_utf8_view(&s, 1, 2);
+    assert_int (bft_len(&v), 5);
+    assert_stn (bft_data(&v), "\xC3\xA9\xE2\x82\xAC", 5);
+    v = bft_utf8_view(&s, 3, 100);
+    assert_int (bft_len(&v), 5);
+    v = bft_utf8_view(&s, 5, 1);
+    check_zero(&v);
+
+    #undef RAND
+}
+
+//=============================================================================
+
+// Reference : leftmost match, first pattern on ties.
+static size_t replace_ref (const char *src, size_t len, 
+    const char **pats, const char **reps, int cnt, char *out, size_t *outlen)
+{
+    size_t found = 0, o = 0;
+    for (size_t i = 0; i < len;) {
+        int hit = -1;
+        for (size_t at = i; at < len && hit < 0; ++at) 
+        for (int k = 0; k < cnt && hit < 0; ++k) {
+            const size_t n = strlen(pats[k]);
+            if (n && at+n <= len && !memcmp(src+at, pats[k], n)) {
+                memcpy(out+o, src+i, at-i);
+                o += at-i;
+                memcpy(out+o, reps[k], strlen(reps[k]));
+                o += strlen(reps[k]);
+                i = at+n;
+                hit = k;
+            }
+        }
+        if (hit < 0) {memcpy(out+o, src+i, len-i); o += len-i; break;}
+        ++found;
+    }
+    *outlen = o;
+    return found;
+}
+
+void replace()
+{
+    char src[600], exp[600*18];
+    uint32_t seed = 7;
+    #define RAND() (seed = seed*1103515245 + 12345, seed >> 8)
+
+    const char *pats[] = {"ab", "a", "aab", "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbba", "", "ba"};
+    const char *reps[] = {"", "xyz", "Q", "-", "never", "longer replacement"};
+
+    for (int round = 0; round < 2000; ++round) {
+        const size_t len = RAND() % (round%2 ? 30 : 600);
+        for (size_t i = 0; i < len; ++i) src[i] = RAND()%5 ? "ab"[RAND()%2] : 'c';
+
+        // single pattern
+        const int k = RAND() % 6, r = RAND() % 6;
+        size_t explen;
+        const size_t expcnt = replace_ref(src, len, &pats[k], &reps[r], 1, exp, &explen);
+
+        Buffet own = bft_memcopy(src, len);
+        const char *data = bft_data(&own);
+        assert_int (bft_replace(&own, pats[k], strlen(pats[k]), reps[r], strlen(reps[r])), expcnt);
+        assert_int (bft_len(&own), explen);
+        assert (!memcmp(bft_data(&own), exp, explen));
+        assert (!bft_data(&own)[explen]);
+        if (strlen(reps[r]) <= strlen(pats[k]) && (len > BUFFET_SSOMAX || explen <= BUFFET_SSOMAX)) 
+            assert (bft_data(&own) == data); // in place
+
+        // shared : co-owner untouched
+        Buffet src2 = bft_memcopy(src, len);
+        Buffet dup = bft_dup(&src2);
+        assert_int (bft_replace(&dup, pats[k], strlen(pats[k]), reps[r], strlen(reps[r])), expcnt);
+        assert (!memcmp(bft_data(&dup), exp, explen));
+        assert_int (bft_len(&src2), len);
+        assert (!memcmp(bft_data(&src2), src, len));
+
+        // table
+        size_t tabcnt = 1 + RAND() % 6;
+        Buffet table[12];
+        const char *tp[6], *tr[6];
+        for (size_t t = 0; t < tabcnt; ++t) {
+            tp[t] = pats[RAND() % 6];
+            tr[t] = reps[RAND() % 6];
+            table[2*t] = bft_memview(tp[t], strlen(tp[t]));
+            table[2*t+1] = bft_memview(tr[t], strlen(tr[t]));
+        }
+        const size_t tabexp = replace_ref(src, len, tp, tr, tabcnt, exp, &explen);
+        Buffet vue = bft_memview(src, len);
+        assert_int (bft_replace_many(&vue, table, tabcnt), tabexp);
+        assert_int (bft_len(&vue), explen);
+        assert (!memcmp(bft_data(&vue), exp, explen));
+
+        bft_free(&vue);
+        bft_free(&dup);
+        bft_free(&src2);
+        bft_free(&own);
+    }
+
+    // no match, no change
+    Buffet vue = bft_memview("hello", 5);
+    assert_int (bft_replace(&vue, "z", 1, "y", 1), 0);
+    assert_int (bft_replace(&vue, "", 0, "y", 1), 0);
+    assert_str (bft_data(&vue), "hello");
+
+    // SSO with views : refused
+    Buffet sso = bft_memcopy("a-b", 3);
+    Buffet ssv = bft_view(&sso, 0, 1);
+    assert_int (bft_replace(&sso, "-", 1, "+", 1), 0);
+    assert_str (bft_data(&sso), "a-b");
+    bft_free(&ssv);
+    assert_int (bft_replace(&sso, "-", 1, "+", 1), 1);
+    assert_str (bft_data(&sso), "a+b");
+
+    #undef RAND
+}
+
+//=============================================================================
+
+#define check_num(fun, val, exp) { \
+    Buffet buf = bft_memcopy("n=", 2); \
+    assert_int (fun(&buf, val), 2 + strlen(exp)); \
+    assert_str (bft_data(&buf) + 2, exp); \
+    bft_free(&buf); \
+}
+
+void appendnum()
+{
+    check_num (bft_append_u64, 0, "0");
+    check_num (bft_append_u64, 9, "9");
+    check_num (bft_append_u64, 10, "10");
+    check_num (bft_append_u64, 1234567890, "1234567890");
+    check_num (bft_append_u64, UINT64_MAX, "18446744073709551615");
+    check_num (bft_append_i64, -1, "-1");
+    check_num (bft_append_i64, INT64_MIN, "-9223372036854775808");
+    check_num (bft_append_i64, INT64_MAX, "9223372036854775807");
+    check_num (bft_append_hex, 0, "0");
+    check_num (bft_append_hex, 0xabc, "abc");
+    check_num (bft_append_hex, UINT64_MAX, "ffffffffffffffff");
+
+    check_num (bft_append_double, 0.0, "0");
+    check_num (bft_append_double, -0.0, "-0");
+    check_num (bft_append_double, 1.0, "1");
+    check_num (bft_append_double, 0.1, "0.1");
+    check_num (bft_append_double, -1234.5, "-1234.5");
+    check_num (bft_append_double, 1e20, "100000000000000000000");
+    check_num (bft_append_double, 1e21, "1e+21");
+    check_num (bft_append_double, 0.000001, "0.000001");
+    check_num (bft_append_double, 1.5e-7, "1.5e-7");
+    check_num (bft_append_double, 5e-324, "5e-324");
+    check_num (bft_append_double, 1.7976931348623157e308, "1.7976931348623157e+308");
+    check_num (bft_append_double, 9007199254740993.0, "9007199254740992");
+    check_num (bft_append_double, 0.0/0.0, "nan");
+    check_num (bft_append_double, -1.0/0.0, "-inf");
+
+    // every integer width, SSO to OWN
+    Buffet buf = BUFFET_ZERO;
+    char exp[1024] = {0};
+    uint64_t v = 7;
+    for (int i = 0; i < 20; ++i, v = v*10 + i%10) {
+        bft_append_u64(&buf, v);
+        bft_append(&buf, ",", 1);
+        sprintf(exp + strlen(exp), "%llu,", (unsigned long long)v);
+        assert_str (bft_data(&buf), exp);
+    }
+    bft_free(&buf);
+
+    // shortest round-trip
+    uint64_t seed = 88172645463325252ull;
+    char tmp[40];
+    for (int i = 0; i < 100000; ++i) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        uint64_t bits = i%2 ? seed : seed & 0x800FFFFFFFFFFFFFull; // subnormals
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        if (d != d || d-d != 0) continue;
+
+        Buffet out = BUFFET_ZERO;
+        bft_append_double(&out, d);
+        const double back = strtod(bft_data(&out), NULL);
+        assert (!memcmp(&back, &d, sizeof(d)));
+
+        // no shorter %e rounds back
+        char sigs[40];
+        int sig = 0;
+        for (const char *c = bft_data(&out); *c && *c != 'e'; ++c) 
+            if (isdigit(*c) && (sig || *c != '0')) sigs[sig++] = *c;
+        while (sig > 1 && sigs[sig-1] == '0') --sig;
+        if (sig > 1) {
+            snprintf(tmp, sizeof(tmp), "%.*e", sig-2, d);
+            assert (strtod(tmp, NULL) != d);
+        }
+        bft_free(&out);
+    }
+}
+
+void tonum()
+{
+    #define VIEW(s) bft_memview(s, strlen(s))
+    uint64_t u;
+    int64_t i;
+    double d;
+
+    // integers
+    const char *ints[] = {"0", "7", "+42", "-42", "12345678", "123456789012", 
+        "9223372036854775807", "-9223372036854775808", "18446744073709551615"};
+    for (size_t k = 0; k < sizeof(ints)/sizeof(*ints); ++k) {
+        Buffet v = VIEW(ints[k]);
+        const bool fitsi = k < 8, fitsu = ints[k][0] != '-';
+        assert (bft_to_i64(&v, &i) == fitsi);
+        if (fitsi) assert (i == strtoll(ints[k], NULL, 10));
+        assert (bft_to_u64(&v, &u) == fitsu);
+        if (fitsu) assert (u == strtoull(ints[k], NULL, 10));
+    }
+    const char *badints[] = {"", "-", "+", "1a", "a1", " 1", "1 ", "1.0", "--1",
+        "9223372036854775808", "-9223372036854775809", "18446744073709551616", 
+        "99999999999999999999999"};
+    for (size_t k = 0; k < sizeof(badints)/sizeof(*badints); ++k) {
+        Buffet v = VIEW(badints[k]);
+        i = 5;
+        assert (!bft_to_i64(&v, &i));
+        assert (i == 5);
+    }
+    Buffet neg = VIEW("-1");
+    assert (!bft_to_u64(&neg, &u));
+
+    // bounded : view on a field, no terminator
+    const char *csv = "123,-4.5e1,x";
+    Buffet f0 = bft_memview(csv, 3);
+    Buffet f1 = bft_memview(csv+4, 6);
+    assert (bft_to_i64(&f0, &i) && i == 123);
+    assert (bft_to_double(&f1, &d) && d == -45);
+
+    // doubles, same as strtod
+    const char *dbls[] = {"0", "-0", "1", ".5", "5.", "1e10", "1E-10", "+3.25",
+        "0.1", "3.141592653589793", "1.7976931348623157e308", "1.8e308", 
+        "4.9e-324", "2.4e-324", "1e-400", "123456789012345678901234567890", 
+        "0.000000000000000000000000000012345", "9007199254740993", 
+        "2.2250738585072011e-308", "7.2057594037927933e16", 
+        "0.30000000000000004", "inf", "-Infinity", "nan"};
+    for (size_t k = 0; k < sizeof(dbls)/sizeof(*dbls); ++k) {
+        Buffet v = VIEW(dbls[k]);
+        assert (bft_to_double(&v, &d));
+        const double exp = strtod(dbls[k], NULL);
+        assert (!memcmp(&d, &exp, sizeof(d)) || (d != d && exp != exp));
+    }
+    // saturated exponent offset by a long fraction
+    const size_t nz = 699999;
+    char *longfrac = malloc(nz + 16);
+    memset(longfrac, '0', nz + 2);
+    longfrac[1] = '.';
+    strcpy(longfrac+2+nz, "1e700000");
+    Buffet lf = VIEW(longfrac);
+    assert (bft_to_double(&lf, &d) && d == strtod(longfrac, NULL) && d == 1);
+    lf = VIEW("1e700000");
+    assert (bft_to_double(&lf, &d) && d == 1.0/0.0);
+    lf = VIEW("-1e-700000");
+    assert (bft_to_double(&lf, &d) && d == 0 && 1/d < 0);
+    free(longfrac);
+
+    const char *baddbls[] = {"", ".", "-", "e1", "1e", "1e+", "1..2", "1.2.3", 
+        "0x1p3", "1f", " 1", "in", "infinit", "nana"};
+    for (size_t k = 0; k < sizeof(baddbls)/sizeof(*baddbls); ++k) {
+        Buffet v = VIEW(baddbls[k]);
+        assert (!bft_to_double(&v, &d));
+    }
+
+    // random round-trips
+    uint64_t seed = 88172645463325252ull;
+    char tmp[64];
+    for (int k = 0; k < 100000; ++k) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        memcpy(&d, &seed, sizeof(d));
+        if (d != d || d-d != 0) continue;
+        snprintf(tmp, sizeof(tmp), "%.*g", 1 + k%17, d);
+        Buffet v = VIEW(tmp);
+        double got;
+        assert (bft_to_double(&v, &got));
+        const double exp = strtod(tmp, NULL);
+        assert (!memcmp(&got, &exp, sizeof(d)));
+    }
+
+    // columns
+    Buffet fields[] = {VIEW("1.5"), VIEW("x"), VIEW("-2"), VIEW(""), VIEW("1e3")};
+    double dcol[5];
+    int64_t icol[5];
+    assert_int (bft_to_double_many(fields, 5, dcol), 3);
+    assert (dcol[0] == 1.5 && dcol[1] != dcol[1] && dcol[2] == -2 && dcol[4] == 1000);
+    assert_int (bft_to_i64_many(fields, 5, icol), 1);
+    assert (icol[2] == -2 && !icol[0]);
+
+    #undef VIEW
+}
+
+#define check_fmt(buf, ...) { \
+    char exp[512]; \
+    const size_t pre = bft_len(buf); \
+    snprintf(exp, sizeof(exp), __VA_ARGS__); \
+    assert_int (bft_appendf(buf, __VA_ARGS__), pre + strlen(exp)); \
+    assert_str (bft_data(buf) + pre, exp); \
+}
+
+void appendf()
+{
+    // into SSO, then growing, then OWN tail
+    Buffet buf = BUFFET_ZERO;
+    check_fmt (&buf, "a%db", 42);
+    check_fmt (&buf, "%s|%5s|%-5s|%.2s", "xy", "xy", "xy", "xyz");
+    check_fmt (&buf, "%u %x %X %o %c %%", 7u, 255u, 255u, 8u, 'q');
+    check_fmt (&buf, "%ld %lld %zu %zd %jd %td", -1L, -2LL, (size_t)3, 
+        (ssize_t)-4, (intmax_t)5, (ptrdiff_t)6);
+    check_fmt (&buf, "%hhd %hd %hhu", 300, 70000, 257);
+    check_fmt (&buf, "%05d|%+d|% d|%-4d|%*d|%.*f", 42, 42, 42, 42, 6, 42, 3, 3.14159);
+    check_fmt (&buf, "%f %e %g %a %.0f %Lf", 1.5, 1e-20, 1e100, 1.0, 2.5, 3.25L);
+    check_fmt (&buf, "%lu %llu", ULONG_MAX, ULLONG_MAX);
+    check_fmt (&buf, "%d %d", INT_MIN, INT_MAX);
+    check_fmt (&buf, "%p", (void*)&buf);
+    check_fmt (&buf, "%s", "");
+    check_fmt (&buf, "%ls|%5ls", L"hi", L"wide");
+    check_fmt (&buf, "%lc|%c|%3lc", (wint_t)L'w', 'c', (wint_t)L'x');
+    check_fmt (&buf, "no conversion");
+    check_fmt (&buf, "%200s", "wide, over spare room");
+    bft_free(&buf);
+
+    // NULL strings as printf prints them
+    Buffet nul = BUFFET_ZERO;
+    assert_int (bft_appendf(&nul, "%s|%8s", (char*)NULL, (char*)NULL), 15);
+    assert_str (bft_data(&nul), "(null)|  (null)");
+    bft_free(&nul);
+
+    // %B : any kind, no terminator needed
+    Buffet sso = bft_memcopy("sso", 3);
+    Buffet own = bft_memcopy(alpha, 40);
+    Buffet vue = bft_memview("viewed, not terminated", 6);
+    Buffet zero = BUFFET_ZERO;
+    Buffet out = bft_memcopy(">", 1);
+    assert (bft_appendf(&out, "%B/%B/%B/%B<", &sso, &own, &vue, &zero));
+    char exp[128];
+    snprintf(exp, sizeof(exp), ">sso/%.40s/viewed/<", alpha);
+    assert_str (bft_data(&out), exp);
+
+    // shared and viewed targets : formatted elsewhere, sources intact
+    Buffet dup = bft_dup(&own);
+    check_fmt (&dup, "+%d", 1);
+    assert_int (bft_len(&own), 40);
+    Buffet onvue = bft_memview(alpha, 10);
+    check_fmt (&onvue, "+%s%d", "x", 2);
+    assert_int (strlen(alpha), alphalen);
+    Buffet empty = bft_memview(alpha, 10);
+    assert_int (bft_appendf(&empty, "%s%.0s%B", "", "x", &zero), 10);
+    assert (bft_data(&empty) == alpha);
+
+    // many small appends staying in place
+    Buffet log = bft_new(1000);
+    const char *data = bft_data(&log);
+    for (int i = 0; i < 50; ++i) check_fmt (&log, "%d:%s;", i, "ok");
+    assert (bft_data(&log) == data);
+
+    // unsupported : nothing appended, even after growing
+    int n;
+    const size_t loglen = bft_len(&log);
+    assert (!bft_appendf(&log, "%n", &n));
+    assert (!bft_appendf(&log, "abc %d %n", 5, &n));
+    assert (!bft_appendf(&log, "%2000s %n", "x", &n));
+    assert_int (bft_len(&log), loglen);
+    assert_int (strlen(bft_data(&log)), loglen);
+    Buffet small = bft_memcopy("x", 1);
+    assert (!bft_appendf(&small, "abc %d %n", 5, &n));
+    assert_str (bft_data(&small), "x");
+    assert (!bft_appendf(&small, "%40s %n", "y", &n));
+    assert_int (bft_len(&small), 1);
+    assert_str (bft_data(&small), "x");
+    bft_free(&small);
+
+    bft_free(&log);
+    bft_free(&onvue);
+    bft_free(&dup);
+    bft_free(&out);
+    bft_free(&own);
+    bft_free(&sso);
+}
+
+//=============================================================================
+
+void template()
+{
+    BuffetTemplate tpl = bft_template("{host} - {path} {status} ({host})");
+    assert (tpl.parts);
+    assert_int (tpl.slots, 3);
+    assert_int (bft_template_slot(&tpl, "host"), 0);
+    assert_int (bft_template_slot(&tpl, "status"), 2);
+    assert_int (bft_template_slot(&tpl, "nope"), -1);
+
+    // small : SSO
+    Buffet args[3] = {
+        bft_memcopy("h", 1), 
+        bft_memview("/p, not terminated", 2), 
+        bft_memcopy("200", 3)
+    };
+    Buffet out = bft_render(&tpl, args);
+    assert_str (bft_data(&out), "h - /p 200 (h)");
+    assert_int (bft_len(&out), 14);
+    assert_int (bft_cap(&out), BUFFET_SSOMAX);
+    bft_free(&out);
+
+    // large : one exact store
+    bft_free(&args[0]);
+    args[0] = bft_memcopy(alpha, alphalen);
+    out = bft_render(&tpl, args);
+    assert_int (bft_len(&out), 2*alphalen + 12);
+    assert (!memcmp(bft_data(&out), alpha, alphalen));
+    assert (!memcmp(bft_data(&out) + alphalen, " - /p 200 (", 11));
+    assert_str (bft_data(&out) + alphalen + 11 + alphalen, ")");
+    assert_int (bft_cap(&out), bft_len(&out));
+    bft_free(&out);
+    bft_template_free(&tpl);
+    assert (!tpl.parts);
+
+    // braces, no slot, empty
+    tpl = bft_template("{{{a}}}");
+    Buffet x = bft_memcopy("x", 1);
+    out = bft_render(&tpl, &x);
+    assert_str (bft_data(&out), "{x}");
+    bft_free(&out);
+    bft_template_free(&tpl);
+
+    tpl = bft_template("");
+    assert (tpl.parts);
+    out = bft_render(&tpl, NULL);
+    assert_int (bft_len(&out), 0);
+    bft_template_free(&tpl);
+
+    // malformed
+    assert (!bft_template("{a").parts);
+    assert (!bft_template("a}b").parts);
+    assert (!bft_template("{}").parts);
+    assert (!bft_template("{a{b}").parts);
+
+    for (int i = 0; i < 3; ++i) bft_free(&args[i]);
+}
+
+//=============================================================================
+
+static size_t
+b64_ref (char *dst, const unsigned char *src, size_t len)
+{
+    const char *abc = 
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t o = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = src[i] << 16;
+        if (i+1 < len) v |= src[i+1] << 8;
+        if (i+2 < len) v |= src[i+2];
+        dst[o++] = abc[v >> 18];
+        dst[o++] = abc[v >> 12 & 63];
+        dst[o++] = i+1 < len ? abc[v >> 6 & 63] : '=';
+        dst[o++] = i+2 < len ? abc[v & 63] : '=';
+    }
+    dst[o] = 0;
+    return o;
+}
+
+void codec()
+{
+    unsigned char src[700];
+    char enc[1000], hex[1401];
+    uint32_t seed = 7;
+    #define RAND() (seed = seed*1103515245 + 12345, seed >> 8)
+
+    for (int round = 0; round < 2000; ++round) {
+        const size_t len = RAND() % (round < 1000 ? 80 : sizeof(src));
+        for (size_t i = 0; i < len; ++i) src[i] = RAND();
+        const Buffet raw = bft_memview((char*)src, len);
+
+        // base64 : encode, then decode in place, shared, viewed
+        const size_t elen = b64_ref(enc, src, len);
+        Buffet b64 = bft_base64_encode(&raw);
+        assert_int (bft_len(&b64), elen);
+        assert_str (bft_data(&b64), enc);
+
+        Buffet co = bft_dup(&b64);
+        assert (bft_base64_decode(&co));
+        assert_int (bft_len(&co), len);
+        assert (!memcmp(bft_data(&co), src, len));
+        assert_str (bft_data(&b64), enc);
+
+        const char *data = bft_data(&b64);
+        bft_free(&co);
+        assert (bft_base64_decode(&b64));
+        assert (len <= BUFFET_SSOMAX || bft_data(&b64) == data);
+        assert_int (bft_len(&b64), len);
+        assert (!memcmp(bft_data(&b64), src, len));
+        bft_free(&b64);
+
+        // unpadded
+        size_t ulen = elen;
+        while (ulen && enc[ulen-1] == '=') --ulen;
+        Buffet vue = bft_memview(enc, ulen);
+        assert (bft_base64_decode(&vue));
+        assert (!memcmp(bft_data(&vue), src, len));
+        bft_free(&vue);
+
+        // hex, upper case decoded too
+        for (size_t i = 0; i < len; ++i) sprintf(hex + 2*i, "%02x", src[i]);
+        hex[2*len] = 0;
+        Buffet hx = bft_hex_encode(&raw);
+        assert_str (bft_data(&hx), hex);
+        assert (bft_hex_decode(&hx));
+        assert_int (bft_len(&hx), len);
+        assert (!memcmp(bft_data(&hx), src, len));
+        bft_free(&hx);
+        for (size_t i = 0; i < 2*len; ++i) hex[i] = toupper(hex[i]);
+        vue = bft_memview(hex, 2*len);
+        assert (bft_hex_decode(&vue));
+        assert (!memcmp(bft_data(&vue), src, len));
+        bft_free(&vue);
+
+        // a bad char anywhere : false, untouched
+        if (len) {
+            const char bad[] = {'=', '-', '_', ' ', '\n', '\0', 0x80, '.', ':'};
+            size_t at = RAND() % ulen;
+            const char c = bad[RAND() % sizeof(bad)];
+            if (c == '=' && at+2 >= ulen) at = 0; // would be padding
+            char save = enc[at];
+            enc[at] = c;
+            Buffet b = bft_memcopy(enc, ulen);
+            assert (!bft_base64_decode(&b));
+            assert (!memcmp(bft_data(&b), enc, ulen));
+            bft_free(&b);
+            enc[at] = save;
+
+            at = RAND() % (2*len);
+            save = hex[at];
+            hex[at] = c == '=' ? 'G' : c;
+            b = bft_memcopy(hex, 2*len);
+            assert (!bft_hex_decode(&b));
+            assert (!memcmp(bft_data(&b), hex, 2*len));
+            bft_free(&b);
+            hex[at] = save;
+        }
+    }
+
+    // malformed lengths and padding
+    const char *bad[] = {"A", "AB=", "A===", "ABCDE", "AB=C", "=AAA"};
+    for (size_t i = 0; i < sizeof(bad)/sizeof(*bad); ++i) {
+        Buffet b = bft_memview(bad[i], strlen(bad[i]));
+        assert (!bft_base64_decode(&b));
+        bft_free(&b);
+    }
+    Buffet odd = bft_memview("abc", 3);
+    assert (!bft_hex_decode(&odd));
+
+    Buffet b = bft_memview("TWFu", 4);
+    assert (bft_base64_decode(&b));
+    assert_str (bft_data(&b), "Man");
+    bft_free(&b);
+    #undef RAND
+}
+
+//=============================================================================
+
+void json()
+{
+    char src[600], exp[600*6+1];
+    uint32_t seed = 3;
+    #define RAND() (seed = seed*1103515245 + 12345, seed >> 8)
+
+    for (int round = 0; round < 2000; ++round) {
+        // mostly plain text, some rounds with specials
+        const size_t len = RAND() % (round < 1000 ? 64 : sizeof(src));
+        const int rate = round % 4 ? 50 : 0;
+        for (size_t i = 0; i < len; ++i) {
+            const char specials[] = "\"\\\n\t\r\b\f\x01\x1f";
+            src[i] = rate && RAND() % rate == 0 ? 
+                specials[RAND() % (sizeof(specials)-1)] : (char)(0x20 + RAND() % 0x60);
+        }
+
+        size_t elen = 0;
+        for (size_t i = 0; i < len; ++i) {
+            const unsigned char c = src[i];
+            char sh = 0;
+            switch (c) {
+                case '"': case '\\': sh = c; break;
+                case '\b': sh = 'b'; break;
+                case '\f': sh = 'f'; break;
+                case '\n': sh = 'n'; break;
+                case '\r': sh = 'r'; break;
+                case '\t': sh = 't'; break;
+            }
+            if (sh) {
+                exp[elen++] = '\\';
+                exp[elen++] = sh;
+            } else if (c < 0x20) {
+                elen += sprintf(exp+elen, "\\u%04x", c);
+            } else {
+                exp[elen++] = c;
+            }
+        }
+        exp[elen] = 0;
+
+        Buffet buf = bft_memcopy(src, len);
+        Buffet esc = bft_json_escape(&buf);
+        assert_int (bft_len(&esc), elen);
+        assert (!memcmp(bft_data(&esc), exp, elen));
+        if (elen == len && len > BUFFET_SSOMAX) 
+            assert (bft_data(&esc) == bft_data(&buf));
+
+        Buffet back;
+        assert (bft_json_unescape(&esc, &back));
+        assert_int (bft_len(&back), len);
+        assert (!memcmp(bft_data(&back), src, len));
+
+        bft_free(&back);
+        bft_free(&esc);
+        bft_free(&buf);
+    }
+
+    // \u escapes to UTF-8, \/ accepted
+    const char *in[] = {"\\u0041\\/", "\\u00e9", "\\u20AC", "\\ud83d\\ude00", 
+        "a\\u0000b"};
+    const char *out[] = {"A/", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", 
+        "a\0b"};
+    const size_t outlen[] = {2, 2, 3, 4, 3};
+    for (size_t i = 0; i < sizeof(in)/sizeof(*in); ++i) {
+        Buffet e = bft_memview(in[i], strlen(in[i])), u;
+        assert (bft_json_unescape(&e, &u));
+        assert_int (bft_len(&u), outlen[i]);
+        assert (!memcmp(bft_data(&u), out[i], outlen[i]));
+        bft_free(&u);
+    }
+
+    // malformed
+    const char *bad[] = {"\\", "a\\x", "\\u12", "\\u12G4", "\\ud800", 
+        "\\udc00", "\\ud800\\u0041", "\\ud800x\\udc00"};
+    for (size_t i = 0; i < sizeof(bad)/sizeof(*bad); ++i) {
+        Buffet e = bft_memview(bad[i], strlen(bad[i]));
+        Buffet u = BUFFET_ZERO;
+        assert (!bft_json_unescape(&e, &u));
+        assert_int (bft_len(&u), 0);
+    }
+
+    // nothing to do : views stay views of the source
+    const char *plain = "no escape needed, nor any backslash";
+    Buffet vue = bft_memview(plain, strlen(plain));
+    Buffet same = bft_json_escape(&vue);
+    assert (bft_data(&same) == plain);
+    Buffet back;
+    assert (bft_json_unescape(&vue, &back));
+    assert (bft_data(&back) == plain);
+    #undef RAND
+}
+
+//=============================================================================
+
+void hash()
+{
+    char *src = repeat(ALPHA64, 5001);
+
+    // same data, same hash : kinds, alignments
+    for (size_t len = 0; len < 2200; len += (len < 80 ? 1 : 61)) {
+        Buffet own = bft_memcopy(src, len);
+        Buffet vue = bft_memview(src+64, len);
+        const uint64_t h = bft_hash(&own);
+        assert (h == bft_hash(&vue));
+        assert (h == bft_hash(&own)); // cached
+        bft_free(&own);
+    }
+
+    // SSO bytes after len are ignored
+    for (size_t len = 0; len < BUFFET_SSOMAX; ++len) {
+        Buffet a = bft_memview(alpha, len);
+        Buffet b = bft_memcopy(alpha, BUFFET_SSOMAX);
+        b.sso.len = len;
+        assert (bft_hash(&a) == bft_hash(&b));
+    }
+
+    // any byte counts
+    const size_t lens[] = {5, 8, 16, 17, 21, 24, 100, 1500, 5000};
+    for (size_t k = 0; k < sizeof(lens)/sizeof(*lens); ++k) {
+        const size_t len = lens[k];
+        Buffet vue = bft_memview(src, len);
+        const uint64_t h = bft_hash(&vue);
+        for (size_t i = 0; i < len; i += 1 + len/50) {
+            src[i] ^= 1;
+            assert (h != bft_hash(&vue));
+            src[i] ^= 1;
+        }
+        Buffet shorter = bft_memview(src, len-1);
+        assert (h != bft_hash(&shorter));
+    }
+
+    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // lanes : AVX2 kernel against values of a scalar build,
+    // every length mod 64, across scrambles
+    static const uint64_t lanes[64] = {
+        0x9914cfa4a9b9af46, 0xfeae681d207a709c, 0x967cf74222da87bf,
+        0xbad90d65f519545d, 0xc0e3840da4151a53, 0xbab2588332e133f7,
+        0x01c320e0fe990efa, 0xd8763cd8e49e4f08, 0x44fcc249857149ba,
+        0x57016c1ded50cf95, 0xc60955ced6b22ffe, 0xf6f13184147962ed,
+        0x014ed2a39f46a28c, 0x919fd3422a1128f8, 0xba4706892847ee8e,
+        0xfd7265bce8ec4531, 0xfc1fe225e4de29d6, 0x2625d852012f1c28,
+        0x385acc184a8e9b79, 0xe45306a76d5884e9, 0xe1bc484c08665a28,
+        0x5999d29f648a32f0, 0xef0c5cf882ca0cdd, 0x9b7dbfd548fb0aff,
+        0x7ece859d1eb46d04, 0xac7360f9c2630e1c, 0x85708b7fec753e86,
+        0x05e29c336d782cca, 0x45764cafe1ac7055, 0xcdfbd37b87b5365e,
+        0xcaba59d1cecf3b8b, 0x9af1974d11b6a5cb, 0x4177b7f5f6aba1fe,
+        0x330be18ec01f7490, 0x9b48d9c3c8d736e8, 0x5a94fcba789235d8,
+        0x1b178644682ef1ee, 0x61482a16db06eb98, 0x39172cda04a942d5,
+        0xa4e0568aaf3a9d60, 0xe5924d5621f25b9a, 0x3b6df182eb927c92,
+        0x98cfb599a3221d60, 0x2bf266660bd32e97, 0x4c72234d7e124a2b,
+        0xdb922b6b353eba8c, 0xd69f857a631165cf, 0xeb652dc084638e9e,
+        0x13126a13f70106e3, 0xe07243890bf56fe0, 0x9695a07ca2a80d1d,
+        0x11aa0ced3af8660d, 0x143e91a5c7242e6a, 0xc857bec8ac3f246d,
+        0x1624363d90325399, 0xf096ccea17a99f1e, 0xf6b0bb2ac1cc1268,
+        0x5471dde1bceba4a4, 0xe6882e12e6782f8e, 0xf8562e741b9deae3,
+        0x7577e7ffd1a065f5, 0x321791b134c87a19, 0x3f66c8daf90c8ae2,
+        0x18e37fcbfffee08c
+    };
+    char *mix = malloc(6000);
+    for (int i = 0; i < 6000; ++i) mix[i] = (char)(i*131 + (i>>7));
+    for (int k = 0; k < 64; ++k) {
+        Buffet vue = bft_memview(mix + k, 1024 + 65*k);
+        assert (bft_hash(&vue) == lanes[k]);
+    }
+    free(mix);
+    #endif
+
+    // cache dropped on append
+    Buffet buf = bft_memcopy(src, 40);
+    bft_hash(&buf);
+    bft_append(&buf, "!", 1);
+    Buffet expect = bft_memcopy(bft_data(&buf), 41);
+    assert (bft_hash(&buf) == bft_hash(&expect));
+
+    // co-owner appending in place at store end
+    Buffet dup = bft_dup(&buf);
+    const uint64_t h = bft_hash(&buf);
+    bft_append(&dup, "?", 1);
+    assert (bft_hash(&buf) == h);
+    Buffet dupexp = bft_memcopy(bft_data(&dup), 42);
+    assert (bft_hash(&dup) == bft_hash(&dupexp));
+
+    bft_free(&dupexp);
+    bft_free(&dup);
+    bft_free(&expect);
+    bft_free(&buf);
+    free(src);
+}
+
+#define MANYCNT 1000
+
+void hash_many()
+{
+    Buffet parts[MANYCNT];
+    uint64_t out[MANYCNT];
+    char *src = repeat(ALPHA64, 300);
+
+    // views ending at a page followed by a guard page
+    const long pg = sysconf(_SC_PAGESIZE);
+    char *edge = mmap(NULL, 2*pg, PROT_READ|PROT_WRITE, 
+        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    assert (edge != MAP_FAILED);
+    memcpy(edge + pg - 64, src, 64);
+    assert (!mprotect(edge + pg, pg, PROT_NONE));
+
+    // mixed kinds and lengths
+    Buffet own = bft_memcopy(src, 300);
+    for (int i = 0; i < MANYCNT; ++i) {
+        const size_t len = (i*7) % (i%5 ? 30 : 280);
+        switch (i%4) {
+            case 0: parts[i] = bft_memcopy(src + i%11, len); break;
+            case 1: parts[i] = bft_memview(src + i%13, len); break;
+            case 2: parts[i] = bft_memview(edge + pg - len%64, len%64); break;
+            default: parts[i] = bft_view(&own, i%9, len);
+        }
+    }
+
+    const int cnts[] = {0, 1, 7, 8, 9, 100, MANYCNT};
+    for (size_t c = 0; c < sizeof(cnts)/sizeof(*cnts); ++c) {
+        memset(out, 0, sizeof(out));
+        bft_hash_many(parts, cnts[c], out);
+        for (int i = 0; i < cnts[c]; ++i) 
+            assert (out[i] == bft_hash(&parts[i]));
+        for (int i = cnts[c]; i < MANYCNT; ++i) 
+            assert (!out[i]);
+    }
+
+    for (int i = 0; i < MANYCNT; ++i) bft_free(&parts[i]);
+    bft_free(&own);
+    munmap(edge, 2*pg);
+    free(src);
+}
+
+//=============================================================================
+
+#define SORTCNT (100*1000)
+
+static int sort_cmp (const void *a, const void *b) {return bft_cmp(a, b);}
+
+// Fill `parts` with mixed kinds : shared prefixes, NULs, high bytes.
+static void sort_fill (Buffet *parts, int cnt, const Buffet *own, int prefix)
+{
+    const char *src = bft_data(own);
+    char tmp[64];
+    unsigned seed = 1;
+    for (int i = 0; i < cnt; ++i) {
+        seed = seed * 1103515245 + 12345;
+        const unsigned r = seed >> 8;
+        int n = prefix;
+        memset(tmp, 'p', prefix);
+        const int extra = r % (i%3 ? 4 : 40);
+        for (int k = 0; k < extra; ++k) 
+            tmp[n++] = "\0\x01az\xff"[(r >> (k%20)) % 5];
+        switch (i%4) {
+            case 0: parts[i] = bft_memcopy(tmp, n); break;
+            case 1: parts[i] = bft_memcopy(tmp, n%8); break;
+            case 2: parts[i] = bft_memview(src + r%26, r%30); break;
+            default: parts[i] = bft_view((Buffet*)own, r%26, r%40);
+        }
+    }
+}
+
+static void sort_check (bool (*sort)(Buffet*, int), int cnt, int prefix)
+{
+    Buffet *parts = malloc(cnt * sizeof(Buffet));
+    Buffet *ref = malloc(cnt * sizeof(Buffet));
+    char *src = repeat(ALPHA64, 128);
+    Buffet own = bft_memcopy(src, 128);
+
+    sort_fill(parts, cnt, &own, prefix);
+    memcpy(ref, parts, cnt * sizeof(Buffet));
+    qsort(ref, cnt, sizeof(Buffet), sort_cmp);
+    assert (sort(parts, cnt));
+
+    for (int i = 0; i < cnt; ++i) assert (bft_eq(&parts[i], &ref[i]));
+
+    int distinct = cnt > 0;
+    for (int i = 1; i < cnt; ++i) distinct += !bft_eq(&ref[i], &ref[i-1]);
+    const int ucnt = bft_sort_unique(parts, cnt);
+    assert (ucnt == distinct);
+    for (int i = 1; i < ucnt; ++i) assert (bft_cmp(&parts[i-1], &parts[i]) < 0);
+    for (int i = ucnt; i < cnt; ++i) check_zero(&parts[i]);
+
+    for (int i = 0; i < cnt; ++i) bft_free(&parts[i]);
+    bft_free(&own);
+    free(src);
+    free(ref);
+    free(parts);
+}
+
+void sort()
+{
+    // ties on the prefix key
+    Buffet ab[] = {
+        bft_memcopy("a\0", 2), bft_memcopy("a", 1), bft_memcopy("", 0),
+        bft_memcopy("abcdefgh2", 9), bft_memcopy("abcdefgh1", 9),
+        bft_memcopy("\xff", 1), bft_memcopy("a", 1)
+    };
+    assert (bft_sort(ab, 7));
+    assert (!bft_len(&ab[0]));
+    assert (bft_len(&ab[1]) == 1 && bft_len(&ab[2]) == 1);
+    assert (bft_len(&ab[3]) == 2);
+    assert (!memcmp(bft_data(&ab[4]), "abcdefgh1", 9));
+    assert (!memcmp(bft_data(&ab[5]), "abcdefgh2", 9));
+    assert (bft_data(&ab[6])[0] == '\xff');
+    assert (bft_sort_unique(ab, 7) == 6);
+    check_zero(&ab[6]);
+    for (int i = 0; i < 7; ++i) bft_free(&ab[i]);
+
+    assert (bft_sort(NULL, 0));
+    assert (!bft_sort_unique(NULL, 0));
+
+    const int cnts[] = {1, 2, 31, 32, 1000};
+    for (size_t c = 0; c < sizeof(cnts)/sizeof(*cnts); ++c) {
+        sort_check(bft_sort, cnts[c], 0);
+        sort_check(bft_sort, cnts[c], 10);
+    }
+
+    // parallel : spread keys, then keys sharing their whole prefix
+    sort_check(bft_par_sort, SORTCNT, 0);
+    sort_check(bft_par_sort, SORTCNT, 3);
+    sort_check(bft_par_sort, SORTCNT, 10);
+}
+
+//=============================================================================
+
+#define MAPCNT 5000
+
+void map()
+{
+    BuffetMap map = BUFFET_MAP_ZERO;
+    Buffet keys[MAPCNT];
+    char *big = repeat(ALPHA64, 200);
+    char tmp[64];
+
+    Buffet none = bft_memview("0", 1);
+    assert (!bft_map_get(&map, &none));
+    assert (!bft_map_del(&map, &none));
+
+    // SSO, OWN, VUE keys
+    for (int i = 0; i < MAPCNT; ++i) {
+        int n = snprintf(tmp, sizeof(tmp), 
+            i%3==1 ? "%d-a-long-key-beyond-sso-size" : "%d", i);
+        keys[i] = bft_memcopy(tmp, n);
+        if (i%3==2) {
+            Buffet vue = bft_memview(bft_data(&keys[i]), n);
+            assert (bft_map_put(&map, &vue, (void*)(intptr_t)i));
+        } else {
+            assert (bft_map_put(&map, &keys[i], (void*)(intptr_t)i));
+        }
+    }
+    assert_int (map.cnt, MAPCNT);
+
+    for (int i = 0; i < MAPCNT; ++i) {
+        void **val = bft_map_get(&map, &keys[i]);
+        assert (val && *val == (void*)(intptr_t)i);
+        val = bft_map_getmem(&map, bft_data(&keys[i]), bft_len(&keys[i]));
+        assert (val && *val == (void*)(intptr_t)i);
+    }
+    assert (!bft_map_getmem(&map, "nope", 4));
+    assert (!bft_map_getmem(&map, big, 200));
+
+    // replace
+    assert (bft_map_put(&map, &keys[7], (void*)-1));
+    assert_int (map.cnt, MAPCNT);
+    assert (*bft_map_get(&map, &keys[7]) == (void*)-1);
+
+    // iterate : OWN keys shared, views copied
+    size_t pos = 0, cnt = 0;
+    const Buffet *key;
+    void *val;
+    while (bft_map_next(&map, &pos, &key, &val)) {
+        const int i = val == (void*)-1 ? 7 : (int)(intptr_t)val;
+        assert (bft_eq(key, &keys[i]));
+        if (i%3==1) assert (bft_data(key) == bft_data(&keys[i]));
+        if (i%3==2) assert (bft_data(key) != bft_data(&keys[i]));
+        ++cnt;
+    }
+    assert_int (cnt, MAPCNT);
+
+    // delete half, tombstones reused
+    for (int i = 0; i < MAPCNT; i += 2) assert (bft_map_del(&map, &keys[i]));
+    assert (!bft_map_del(&map, &keys[0]));
+    assert_int (map.cnt, MAPCNT/2);
+    for (int i = 0; i < MAPCNT; ++i) 
+        assert (!bft_map_get(&map, &keys[i]) == !(i%2));
+    const size_t cap = map.cap;
+    for (int rep = 0; rep < 4; ++rep) 
+    for (int i = 0; i < MAPCNT; i += 2) {
+        assert (bft_map_put(&map, &keys[i], NULL));
+        assert (bft_map_del(&map, &keys[i]));
+    }
+    assert_int (map.cap, cap);
+
+    // keys outlive sources
+    for (int i = 0; i < MAPCNT; ++i) bft_free(&keys[i]);
+    Buffet k = bft_memcopy("1-a-long-key-beyond-sso-size", 28);
+    assert (*bft_map_get(&map, &k) == (void*)1);
+    bft_free(&k);
+
+    bft_map_free(&map);
+    assert (!map.cap && !map.cnt);
+    free(big);
+}
+
+//=============================================================================
+
+static void par_upper (Buffet *part, void *arg) {
+    (void)arg;
+    char *data = (char*)bft_data(part);
+    for (size_t i = 0; i < bft_len(part); ++i) 
+        if (data[i] >= 'a' && data[i] <= 'z') data[i] -= 32;
+}
+
+static void par_len (const Buffet *part, void *out, void *arg) {
+    *(size_t*)out = bft_len(part) + *(size_t*)arg;
+}
+
+typedef struct {
+    Buffet *parts;
+    Buffet joined;
+} ParNested;
+
+static void par_nested (Buffet *part, void *arg) {
+    ParNested *n = arg;
+    if (part == n->parts) 
+        n->joined = bft_par_join(n->parts, BUFFET_PAR_JOIN_MIN-1, "|", 1);
+}
+
+#define PARCNT (BUFFET_PAR_JOIN_MIN + BUFFET_PAR_BLOCK/2)
+
+void par()
+{
+    setenv("BUFFET_THREADS", "3", 0); // exercise the pool even on 1 cpu
+
+    // list of 0 to 63 bytes parts
+    Buffet *parts = malloc(PARCNT * sizeof(Buffet));
+    for (int i = 0; i < PARCNT; ++i) 
+        parts[i] = bft_memcopy(alpha, i%64);
+
+    Buffet seq = bft_join(parts, BUFFET_PAR_JOIN_MIN-1, "|", 1);
+
+    // no workers : sequential, block by block
+    pid_t pid = fork();
+    if (!pid) {
+        setenv("BUFFET_THREADS", "0", 1);
+        Buffet nopool = bft_par_join(parts, BUFFET_PAR_JOIN_MIN-1, "|", 1);
+        _exit(bft_cmp(&seq, &nopool) != 0);
+    }
+    int status;
+    assert (pid > 0 && waitpid(pid, &status, 0) == pid);
+    assert (WIFEXITED(status) && !WEXITSTATUS(status));
+
+    Buffet par = bft_par_join(parts, BUFFET_PAR_JOIN_MIN-1, "|", 1);
+    assert_int (bft_cmp(&seq, &par), 0);
+    bft_free(&par);
+
+    // forked once the pool runs : the child starts its own
+    pid = fork();
+    if (!pid) {
+        alarm(10);
+        Buffet forked = bft_par_join(parts, BUFFET_PAR_JOIN_MIN-1, "|", 1);
+        _exit(bft_cmp(&seq, &forked) != 0);
+    }
+    assert (pid > 0 && waitpid(pid, &status, 0) == pid);
+    assert (WIFEXITED(status) && !WEXITSTATUS(status));
+
+    // nested in a pool callback : sequential, block by block
+    ParNested nested = {parts, BUFFET_ZERO};
+    bft_par_for(parts, PARCNT, par_nested, &nested);
+    assert_int (bft_cmp(&seq, &nested.joined), 0);
+    bft_free(&nested.joined);
+    bft_free(&seq);
+
+    // auto par via join()
+    Buffet joined = bft_join(parts, PARCNT, "::", 2);
+    size_t explen = 0;
+    for (int i = 0; i < PARCNT; ++i) explen += i%64;
+    explen += 2*(PARCNT-1);
+    assert_int (bft_len(&joined), explen);
+    int cnt;
+    Buffet *back = bft_split(bft_data(&joined), bft_len(&joined), "::", 2, &cnt);
+    assert_int (cnt, PARCNT);
+    for (int i = 0; i < PARCNT; ++i) assert_int (bft_cmp(&back[i], &parts[i]), 0);
+    free(back);
+    bft_free(&joined);
+
+    size_t add = 1;
+    size_t *lens = malloc(PARCNT * sizeof(size_t));
+    bft_par_map(parts, PARCNT, lens, sizeof(size_t), par_len, &add);
+    for (int i = 0; i < PARCNT; ++i) assert_int (lens[i], i%64 + 1);
+    free(lens);
+
+    bft_par_for(parts, PARCNT, par_upper, NULL);
+    assert_stn (bft_data(&parts[63]), "0123456789ABCDEF", 16);
+    assert_stn (bft_data(&parts[PARCNT-1]), "0123456789ABCDEF", 16);
+
+    Buffet one = bft_memcopy("one", 3);
+    Buffet single = bft_par_join(&one, 1, "|", 1);
+    assert_str (bft_data(&single), "one");
+    Buffet none = bft_par_join(parts, 0, "|", 1);
+    check_zero(&none);
+
+    for (int i = 0; i < PARCNT; ++i) bft_free(&parts[i]);
+    free(parts);
+}
+
+//=============================================================================
+
+// write `len` bytes of alpha pattern to a temp file
+static char* tmpwrite (const char *data, size_t len) {
+    static char path[] = "/tmp/buffet_XXXXXX";
+    strcpy(path + sizeof(path)-7, "XXXXXX");
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    assert(write(fd, data, len) == (ssize_t)len);
+    close(fd);
+    return path;
+}
+
+void umapfile (size_t len) {
+    char *src = repeat(ALPHA64, len);
+    char *path = tmpwrite(src, len);
+    
+    const int nextfd = dup(0);
+    close(nextfd);
+    Buffet buf = bft_mapfile(path, BUFFET_MAP_SEQUENTIAL|BUFFET_MAP_WILLNEED);
+    unlink(path);
+    // file not kept open
+    const int fd = dup(0);
+    assert_int (fd, nextfd);
+    close(fd);
+    assert_int (bft_len(&buf), len);
+    assert (!memcmp(bft_data(&buf), src, len));
+    bool mustfree;
+    const char *cstr = bft_cstr(&buf, &mustfree);
+    assert (!mustfree);
+    assert_int (strlen(cstr), len);
+
+    if (len) {
+        // view outlives owner
+        Buffet ref = bft_view(&buf, 1, len-1);
+        bft_free(&buf);
+        assert (!memcmp(bft_data(&ref), src+1, len-1));
+        // detach from mapping
+        Buffet dup = bft_dup(&ref);
+        size_t rc = bft_append(&ref, "!", 1);
+        assert_int (rc, len);
+        assert (!memcmp(bft_data(&ref), src+1, len-1));
+        assert_int (bft_data(&ref)[len-1], '!');
+        assert (!memcmp(bft_data(&dup), src+1, len-1));
+        bft_free(&dup);
+        bft_free(&ref);
+    }
+
+    bft_free(&buf);
+    free(src);
+}
+
+void mapfile()
+{
+    umapfile(0);
+    umapfile(1);
+    umapfile(BUFFET_SSOMAX);
+    umapfile(100);
+    umapfile(4096);
+    umapfile(3*4096+1);
+
+    Buffet none = bft_mapfile("/nonexistent/buffet", 0);
+    check_zero(&none);
+}
+
+//=============================================================================
+
+#define WVCNT 3000 // > IOV_MAX
+
+void writev_()
+{
+    Buffet parts[WVCNT];
+    for (int i = 0; i < WVCNT; ++i) 
+        parts[i] = (i%5==4) ? BUFFET_ZERO : bft_memcopy(alpha, i%alphalen);
+    Buffet joined = bft_join(parts, WVCNT, "", 0);
+    size_t totlen = bft_len(&joined);
+
+    struct iovec iov[WVCNT];
+    assert_int (bft_to_iovec(parts, WVCNT, iov), totlen);
+    assert (iov[1].iov_base == bft_data(&parts[1]));
+    assert_int (iov[1].iov_len, 1);
+
+    // pipe : small list
+    int fds[2];
+    assert (!pipe(fds));
+    assert_int (bft_writev(fds[1], parts, 10), 32);
+    char back[64] = {0};
+    assert_int (read(fds[0], back, sizeof(back)), 32);
+    assert_stn (back, "0" "01" "012" "01234" "012345", 17);
+    close(fds[0]);
+    close(fds[1]);
+
+    // file : batched list
+    char *path = tmpwrite("", 0);
+    int fd = open(path, O_WRONLY);
+    assert_int (bft_writev(fd, parts, WVCNT), totlen);
+    close(fd);
+    Buffet file = bft_mapfile(path, 0);
+    unlink(path);
+    assert_int (bft_cmp(&file, &joined), 0);
+    bft_free(&file);
+
+    bft_free(&joined);
+    for (int i = 0; i < WVCNT; ++i) bft_free(&parts[i]);
+}
+
+//=============================================================================
+
+#define assert_rope(rope, exp) { \
+    Buffet flat = bft_rope_flatten(rope); \
+    assert_int (bft_len(&flat), strlen(exp)); \
+    assert_str (bft_data(&flat), exp); \
+    bft_free(&flat); \
+}
+
+void rope()
+{
+    BuffetRope rope = BUFFET_ROPE_ZERO;
+    
+    // many appends : one chunk realloc-free
+    size_t len = 0;
+    for (int i = 0; i < 3000; ++i) {
+        len = bft_rope_append(&rope, alpha, 64);
+        assert_int (len, (i+1)*64);
+    }
+    assert_int (rope.cnt, 3);
+    struct iovec iov[8];
+    bft_rope_iovec(&rope, iov, 8);
+    bft_rope_append(&rope, "x", 1);
+    assert_int (rope.cnt, 3);
+    struct iovec iov2[8];
+    bft_rope_iovec(&rope, iov2, 8);
+    assert (iov2[0].iov_base == iov[0].iov_base);
+    Buffet flat = bft_rope_flatten(&rope);
+    assert_int (bft_len(&flat), 3000*64+1);
+    assert_int (rope.cnt, 1);
+    assert_stn (bft_data(&flat)+64*2999, alpha, 64);
+    bft_free(&flat);
+    bft_rope_free(&rope);
+    assert_int (rope.len, 0);
+
+    // insert, prepend, splice
+    bft_rope_append(&rope, "world", 5);
+    bft_rope_insert(&rope, 0, "hello ", 6);
+    bft_rope_insert(&rope, 100, "!", 1);
+    assert_rope (&rope, "hello world!");
+    bft_rope_insert(&rope, 5, ",", 1);
+    assert_rope (&rope, "hello, world!");
+
+    bft_rope_free(&rope);
+    Buffet own = bft_memcopy(alpha, 32);
+    Buffet sso = bft_memcopy(alpha+32, 8);
+    Buffet ssv = bft_view(&sso, 0, 4);
+    Buffet vue = bft_memview(alpha+40, 4);
+    bft_rope_splice(&rope, 0, &own);
+    bft_rope_splice(&rope, 16, &ssv);   // splits own
+    bft_rope_splice(&rope, 0, &vue);
+    bft_rope_splice(&rope, rope.len, &sso);
+    assert_int (rope.cnt, 5);
+    // own shared, not copied
+    bft_rope_iovec(&rope, iov, 8);
+    assert (iov[1].iov_base == bft_data(&own)); 
+    bft_free(&own);
+    bft_free(&ssv);
+    bft_free(&sso);
+    bft_free(&vue);
+    
+    char exp[64] = {0};
+    sprintf(exp, "%.4s%.16s%.4s%.16s%.8s", 
+        alpha+40, alpha, alpha+32, alpha+16, alpha+32);
+
+    // view across chunks
+    BuffetRope view = bft_rope_view(&rope, 2, 30);
+    assert_int (view.len, 30);
+    assert_int (view.cnt, 4);
+    exp[32] = 0;
+    assert_rope (&view, exp+2);
+    bft_rope_free(&view);
+
+    // iovec and writev
+    assert_int (bft_rope_iovec(&rope, iov, 8), 5);
+    assert_int (iov[1].iov_len, 16);
+    int fds[2];
+    assert (!pipe(fds));
+    assert_int (bft_rope_writev(fds[1], &rope), 48);
+    char back[64] = {0};
+    assert_int (read(fds[0], back, sizeof(back)), 48);
+    sprintf(exp, "%.4s%.16s%.4s%.16s%.8s", 
+        alpha+40, alpha, alpha+32, alpha+16, alpha+32);
+    assert_str (back, exp);
+    close(fds[0]);
+    close(fds[1]);
+
+    assert_rope (&rope, exp);
+    bft_rope_free(&rope);
+
+    // many small chunks : batched by IOV_BATCH, not by the list stack
+    char many[3000];
+    for (int i = 0; i < 3000; ++i) {
+        many[2999-i] = alpha[i % 64];
+        bft_rope_insert(&rope, 0, &alpha[i % 64], 1);
+    }
+    assert_int (rope.cnt, 3000);
+    char *path = tmpwrite("", 0);
+    int fd = open(path, O_RDWR);
+    unlink(path);
+    assert_int (bft_rope_writev(fd, &rope), 3000);
+    char manyback[3000];
+    assert_int (pread(fd, manyback, 3000, 0), 3000);
+    assert (!memcmp(manyback, many, 3000));
+    close(fd);
+    bft_rope_free(&rope);
+}
+
+//=============================================================================
+
+void ureader (const char *text, const char *sep, size_t chunksz) {
+    int expcnt;
+    Buffet *exp = bft_splitstr(text, sep, &expcnt);
+    char *path = tmpwrite(text, strlen(text));
+    int fd = open(path, O_RDONLY);
+    unlink(path);
+
+    BuffetReader rd = bft_reader(fd, chunksz);
+    Buffet recs[64];
+    int cnt = 0;
+    while (bft_read_record(&rd, sep, strlen(sep), &recs[cnt])) ++cnt;
+    assert (!rd.err);
+    bft_reader_free(&rd);
+    close(fd);
+    
+    // no empty last record after a final separator
+    if (expcnt && !bft_len(&exp[expcnt-1])) --expcnt;
+    assert_int (cnt, expcnt);
+    for (int i = 0; i < cnt; ++i) {
+        assert_int (bft_cmp(&recs[i], &exp[i]), 0);
+        bft_free(&recs[i]);
+    }
+    free(exp);
+}
+
+void reader()
+{
+    const char *text = 
+    "one\ntwo\n\nthree is a longer line, straddling\nfour\n"
+    "five is a line much longer than a reader chunk\nsix";
+    
+    ureader("", "\n", 0);
+    ureader("\n", "\n", 0);
+    ureader("a", "\n", 0);
+    ureader(text, "\n", 0);
+    ureader(text, "\n", 16);
+    ureader(text, "\n", 5);
+    ureader(text, "in", 7);
+    ureader("a::b:::c::", "::", 3);
+
+    // records outlive the reader, chunks are shared
+    char *path = tmpwrite(text, strlen(text));
+    int fd = open(path, O_RDONLY);
+    unlink(path);
+    BuffetReader rd = bft_reader(fd, 0);
+    Buffet one, two;
+    assert (bft_readline(&rd, &one));
+    assert (bft_readline(&rd, &two));
+    bft_reader_free(&rd);
+    close(fd);
+    assert (bft_data(&two) == bft_data(&one) + 4);
+    assert_stn (bft_data(&one), "one", 3);
+    assert_int (bft_len(&two), 3);
+    bft_free(&one);
+    bft_free(&two);
+
+    // refill in place drops the chunk's hash
+    int pfd[2];
+    assert (!pipe(pfd));
+    assert (write(pfd[1], "ab\ncd", 5) == 5);
+    rd = bft_reader(pfd[0], 64);
+    assert (bft_readline(&rd, &one));
+    const uint64_t before = bft_hash(&rd.chunk);
+    assert (write(pfd[1], "e\n", 2) == 2);
+    close(pfd[1]);
+    assert (bft_readline(&rd, &two));
+    assert_int (bft_len(&rd.chunk), 7);
+    Buffet expect = bft_memview("ab\ncde\n", 7);
+    assert (bft_hash(&rd.chunk) == bft_hash(&expect));
+    assert (before != bft_hash(&expect));
+    bft_reader_free(&rd);
+    close(pfd[0]);
+    bft_free(&one);
+    bft_free(&two);
+
+    // read errors are not a clean end : the unfinished record is dropped
+    rd = bft_reader(-1, 0);
+    assert (!bft_readline(&rd, &one));
+    assert_int (rd.err, EBADF);
+    assert (!bft_readline(&rd, &one));
+    bft_reader_free(&rd);
+
+    path = tmpwrite("a\nb", 3);
+    fd = open(path, O_RDONLY);
+    unlink(path);
+    rd = bft_reader(fd, 3);
+    assert (bft_readline(&rd, &one));
+    close(fd);
+    assert (!bft_readline(&rd, &two));
+    assert_int (rd.err, EBADF);
+    assert (!bft_len(&two));
+    bft_reader_free(&rd);
+    bft_free(&one);
+}
+
+//=============================================================================
+
+void readfd()
+{
+    char *path = tmpwrite(alpha, alphalen);
+    int fd = open(path, O_RDONLY);
+    unlink(path);
+
+    // SSO in place
+    Buffet buf = bft_memcopy("ab", 2);
+    assert_int (bft_read_fd(&buf, fd, 8), 8);
+    assert_str (bft_data(&buf), "ab01234567");
+
+    // grows to OWN
+    assert_int (bft_read_fd(&buf, fd, 32), 32);
+    assert_int (bft_len(&buf), 42);
+    assert_stn (bft_data(&buf)+10, alpha+8, 32);
+    
+    // own in place : no relocation
+    const char *data = bft_data(&buf);
+    assert (bft_cap(&buf) >= 42+16);
+    assert_int (bft_read_fd(&buf, fd, 16), 16);
+    assert (bft_data(&buf) == data);
+    assert_stn (bft_data(&buf)+42, alpha+40, 16);
+
+    // only bytes read are accounted
+    assert_int (bft_read_fd(&buf, fd, 1000), alphalen-56);
+    assert_int (bft_len(&buf), 2+alphalen);
+    assert_int (bft_read_fd(&buf, fd, 1000), 0);
+    assert_int (bft_len(&buf), 2+alphalen);
+    bft_free(&buf);
+
+    // pread on a view detaches
+    Buffet src = bft_memcopy(alpha, 32);
+    Buffet ref = bft_view(&src, 0, 16);
+    assert_int (bft_pread(&ref, fd, 4, 62), 4);
+    assert_stn (bft_data(&ref), alpha, 16);
+    assert_stn (bft_data(&ref)+16, "+=01", 4);
+    check_props(&src, 0, 32);
+    bft_free(&ref);
+    bft_free(&src);
+    close(fd);
+
+    // recv
+    int sv[2];
+    assert (!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    assert_int (write(sv[0], "hello", 5), 5);
+    Buffet msg = bft_memview("say ", 4);
+    assert_int (bft_recv(&msg, sv[1], 64, 0), 5);
+    assert_str (bft_data(&msg), "say hello");
+    bft_free(&msg);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+//=============================================================================
+
+#define uconsume(buf, n, off, len) \
+    assert_int (bft_consume(buf, n), len); \
+    check_props(buf, off, len);
+
+void consume()
+{
+    Buffet sso = bft_memcopy(alpha, 8);
+    uconsume (&sso, 3, 3, 5);
+    uconsume (&sso, 9, 8, 0);
+    
+    Buffet own = bft_memcopy(alpha, 32);
+    Buffet vue = bft_memview(alpha, 32);
+    uconsume (&own, 1, 1, 31);
+    uconsume (&own, 30, 31, 1);
+    uconsume (&vue, 4, 4, 28);
+    bft_free(&own);
+    bft_free(&vue);
+    
+    sso = bft_memcopy(alpha, 16);
+    Buffet ssv = bft_view(&sso, 2, 8);
+    assert_int (bft_consume(&sso, 4), 16); // has view
+    uconsume (&ssv, 2, 4, 6);
+    bft_free(&ssv);
+    bft_free(&sso);
+
+    // stream : append at end, consume from front
+    Buffet stream = bft_new(64);
+    size_t off = 0;
+    for (int i = 0; i < 10000; ++i) {
+        size_t end = off + bft_len(&stream);
+        bft_append(&stream, alpha + end%64, 10); // alpha is periodic
+        size_t n = i%2 ? 13 : 7;
+        assert_int (bft_consume(&stream, n), end + 10 - (off+n));
+        off += n;
+        assert_stn (bft_data(&stream), alpha + off%64, bft_len(&stream));
+        assert (bft_cap(&stream) <= 4*64); // prefix got reclaimed
+    }
+    bft_free(&stream);
+}
+
+//=============================================================================
+
+void saveload()
+{
+    const char *text = "a||b|c|" ALPHA64 "||";
+    int cnt;
+    Buffet *parts = bft_splitstr(text, "|", &cnt);
+    parts[1] = bft_memcopy("sso", 3);
+    parts[2] = bft_memcopy(alpha, 40);
+    
+    char *path = tmpwrite("", 0);
+    assert (!bft_save(path, parts, cnt));
+
+    // OWN parts
+    int outcnt;
+    Buffet *back = bft_load(path, &outcnt, NULL);
+    assert_int (outcnt, cnt);
+    for (int i = 0; i < cnt; ++i) {
+        assert_int (bft_cmp(&back[i], &parts[i]), 0);
+        bool mustfree;
+        bft_cstr(&back[i], &mustfree);
+        assert (!mustfree);
+    }
+    for (int i = 0; i < cnt; ++i) bft_free(&back[i]);
+    free(back);
+
+    // VUE parts on owner
+    Buffet owner;
+    back = bft_load(path, &outcnt, &owner);
+    assert_int (outcnt, cnt);
+    for (int i = 0; i < cnt; ++i) {
+        assert_int (bft_cmp(&back[i], &parts[i]), 0);
+        assert (!bft_len(&back[i]) 
+            || bft_data(&back[i]) > bft_data(&owner));
+    }
+    free(back);
+    bft_free(&owner);
+
+    // empty list
+    assert (!bft_save(path, parts, 0));
+    back = bft_load(path, &outcnt, NULL);
+    assert (back);
+    assert_int (outcnt, 0);
+    free(back);
+
+    // not ours
+    unlink(path);
+    path = tmpwrite(alpha, alphalen);
+    back = bft_load(path, &outcnt, &owner);
+    assert (!back);
+    check_zero(&owner);
+    unlink(path);
+
+    bft_free(&parts[1]);
+    bft_free(&parts[2]);
+    free(parts);
+}
+
+//=============================================================================
+
+// read `len` bytes from `fd` and compare to `expect`
+static void readback (int fd, const char *expect, size_t len) {
+    char *got = malloc(len+1);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t rc = read(fd, got+done, len-done);
+        assert(rc > 0);
+        done += rc;
+    }
+    assert (!memcmp(got, expect, len));
+    free(got);
+}
+
+void uzerocopy (size_t len) {
+    char *src = repeat(ALPHA64, len);
+    const bool own = len > BUFFET_SSOMAX;
+    int pfd[2], sv[2];
+    assert (!pipe(pfd));
+    assert (!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    Buffet pin;
+
+    // to pipe, pin outlives source
+    Buffet buf = bft_memcopy(src, len);
+    assert_int (bft_vmsplice(pfd[1], &buf, &pin), len);
+    assert_int (bft_len(&pin), own ? len : 0);
+    bft_free(&buf);
+    readback(pfd[0], src, len);
+    bft_free(&pin);
+
+    // to socket
+    buf = bft_memcopy(src, len);
+    assert_int (bft_splice(sv[0], &buf, &pin), len);
+    assert_int (bft_len(&pin), own ? len : 0);
+    readback(sv[1], src, len);
+    bft_free(&pin);
+
+    // write() fallback : splice refuses O_APPEND
+    char *path = tmpwrite("", 0);
+    int fd = open(path, O_RDWR|O_APPEND);
+    unlink(path);
+    assert_int (bft_splice(fd, &buf, NULL), len);
+    assert (!lseek(fd, 0, SEEK_SET));
+    readback(fd, src, len);
+    close(fd);
+    bft_free(&buf);
+
+    // mapped range by sendfile
+    path = tmpwrite(src, len);
+    Buffet map = bft_mapfile(path, BUFFET_MAP_KEEPFD);
+    Buffet nofd = bft_mapfile(path, 0);
+    unlink(path);
+    if (len > 2) {
+        Buffet vue = bft_view(&map, 1, len-2);
+        bft_free(&map);
+        assert_int (bft_sendfile(sv[0], &vue), len-2);
+        readback(sv[1], src+1, len-2);
+        assert_int (bft_splice(sv[0], &vue, &pin), len-2);
+        check_zero(&pin);
+        readback(sv[1], src+1, len-2);
+        bft_free(&vue);
+
+        // file closed : write(), vmsplice from the mapping
+        vue = bft_view(&nofd, 1, len-2);
+        assert_int (bft_sendfile(sv[0], &vue), len-2);
+        readback(sv[1], src+1, len-2);
+        assert_int (bft_splice(sv[0], &vue, &pin), len-2);
+        readback(sv[1], src+1, len-2);
+        bft_free(&pin);
+        bft_free(&vue);
+    }
+    bft_free(&map);
+    bft_free(&nofd);
+
+    close(pfd[0]); close(pfd[1]);
+    close(sv[0]); close(sv[1]);
+    free(src);
+}
+
+void zerocopy()
+{
+    uzerocopy(0);
+    uzerocopy(8);
+    uzerocopy(BUFFET_SSOMAX+1);
+    uzerocopy(5000);
+    uzerocopy(32*1024);
+}
+
+//=============================================================================
+
+#define LOADCNT 300 // more than a ring window
+
+void uloadfiles (const char *uring)
+{
+    setenv("BUFFET_URING", uring, 1);
+
+    const char *paths[LOADCNT+2];
+    char *src = repeat(ALPHA64, LOADCNT*11);
+    for (int i = 0; i < LOADCNT; ++i) 
+        paths[i] = strdup(tmpwrite(src+i, i*10));
+    paths[LOADCNT] = "/nonexistent/buffet";
+    paths[LOADCNT+1] = "/tmp";
+
+    const int nextfd = dup(0);
+    close(nextfd);
+    Buffet *bufs = bft_load_files(paths, LOADCNT+2);
+    assert (bufs);
+    // every file closed
+    const int fd = dup(0);
+    assert_int (fd, nextfd);
+    close(fd);
+
+    for (int i = 0; i < LOADCNT; ++i) {
+        assert_int (bft_len(&bufs[i]), i*10);
+        assert (!memcmp(bft_data(&bufs[i]), src+i, i*10));
+        bool mustfree;
+        const char *cstr = bft_cstr(&bufs[i], &mustfree);
+        assert (!mustfree);
+        assert_int (strlen(cstr), i*10);
+        assert (!i || bufs[i].ptr.tag == 1); // OWN
+        bft_free(&bufs[i]);
+        unlink(paths[i]);
+        free((char*)paths[i]);
+    }
+    check_zero(&bufs[LOADCNT]);
+    check_zero(&bufs[LOADCNT+1]);
+
+    free(bufs);
+    free(src);
+    unsetenv("BUFFET_URING");
+}
+
+void loadfiles()
+{
+    uloadfiles("1");
+    uloadfiles("0");
+
+    Buffet *none = bft_load_files(NULL, 0);
+    assert (none);
+    free(none);
+}
+
 //=============================================================================
 void zero()
 {
@@ -705,7 +2766,7 @@ int main()
     run(new);
     run(memcopy);
     run(memview);
-    run(dup);
+    run(dup_);
     run(copy);
     run(view);
     run(cat);
@@ -713,6 +2774,32 @@ int main()
     run(splitjoin);
     run(free_);
     run(cmp);
+    run(eq);
+    run(lowerupper);
+    run(trim);
+    run(tokenize);
+    run(utf8);
+    run(replace);
+    run(appendnum);
+    run(tonum);
+    run(appendf);
+    run(template);
+    run(codec);
+    run(json);
+    run(hash);
+    run(hash_many);
+    run(map);
+    run(par);
+    run(sort);
+    run(mapfile);
+    run(writev_);
+    run(rope);
+    run(reader);
+    run(readfd);
+    run(consume);
+    run(saveload);
+    run(zerocopy);
+    run(loadfiles);
     LOG("unit tests OK");
 
     return 0;